@@ -0,0 +1,383 @@
+/*
+ * onkyoUsbRi: Onkyo RI control
+ *
+ * Copyright (C) 2021. Mikhail Kulesh
+ *
+ * This program is free software: you can redistribute it and/or modify it under the terms of the GNU
+ * General Public License as published by the Free Software Foundation, either version 3 of the License,
+ * or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without
+ * even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details. You should have received a copy of the GNU General
+ * Public License along with this program.
+ */
+
+#include "OnkyoRiClient.h"
+
+#include <cerrno>
+#include <cstdio>
+#include <fcntl.h>
+#include <poll.h>
+#include <regex>
+#include <termios.h>
+#include <unistd.h>
+#include <vector>
+
+using namespace OnkyoRiHost;
+
+/************************************************************************
+ * Class OnkyoRiClient
+ ************************************************************************/
+
+const int OnkyoRiClient::RECONNECT_INTERVAL;
+
+OnkyoRiClient::OnkyoRiClient (const std::string & _path, bool _flowControl) :
+    path { _path },
+    flowControl { _flowControl },
+    fd { -1 },
+    running { false },
+    nextSequence { 0 },
+    timeout { std::chrono::seconds(2) },
+    lastPort { -1 }
+{
+    // empty
+}
+
+OnkyoRiClient::~OnkyoRiClient ()
+{
+    stop();
+}
+
+bool OnkyoRiClient::start ()
+{
+    if (running)
+    {
+        return isConnected();
+    }
+    const bool connected = open();
+    running = true;
+    reader = std::thread(&OnkyoRiClient::run, this);
+    return connected;
+}
+
+void OnkyoRiClient::stop ()
+{
+    if (!running)
+    {
+        return;
+    }
+    running = false;
+    reader.join();
+    close();
+    completeAll(Status::DISCONNECTED, false);
+}
+
+bool OnkyoRiClient::send (unsigned port, uint32_t code, Completion completion)
+{
+    if (port >= PORTS_COUNT || code > MAX_ARGUMENT)
+    {
+        return false;
+    }
+    char command[8];
+    ::snprintf(command, sizeof(command), "%ux%04X", port, code);
+    return write(command, completion);
+}
+
+bool OnkyoRiClient::sendCommand (char opcode, uint32_t argument, Completion completion)
+{
+    if (argument > MAX_ARGUMENT)
+    {
+        return false;
+    }
+    char command[8];
+    ::snprintf(command, sizeof(command), "%cx%04X", opcode, argument);
+    return write(command, completion);
+}
+
+size_t OnkyoRiClient::getPending ()
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    return pending.size();
+}
+
+const char * OnkyoRiClient::toString (Status status)
+{
+    switch (status)
+    {
+    case Status::DONE:
+        return "done";
+    case Status::REJECTED:
+        return "rejected";
+    case Status::DROPPED:
+        return "dropped";
+    case Status::TIMEOUT:
+        return "timeout";
+    case Status::DISCONNECTED:
+        return "disconnected";
+    }
+    return "unknown";
+}
+
+bool OnkyoRiClient::open ()
+{
+    const int f = ::open(path.c_str(), O_RDWR | O_NOCTTY | O_NONBLOCK);
+    if (f < 0)
+    {
+        return false;
+    }
+    termios attr;
+    if (::tcgetattr(f, &attr) != 0)
+    {
+        ::close(f);
+        return false;
+    }
+    ::cfmakeraw(&attr);
+    ::cfsetispeed(&attr, B115200);
+    ::cfsetospeed(&attr, B115200);
+    attr.c_cflag |= CLOCAL | CREAD;
+    if (flowControl)
+    {
+        attr.c_cflag |= CRTSCTS;
+    }
+    else
+    {
+        attr.c_cflag &= ~CRTSCTS;
+    }
+    if (::tcsetattr(f, TCSANOW, &attr) != 0)
+    {
+        ::close(f);
+        return false;
+    }
+    ::tcflush(f, TCIOFLUSH);
+    line.clear();
+    lastPort = -1;
+    fd = f;
+    return true;
+}
+
+void OnkyoRiClient::close ()
+{
+    const int f = fd.exchange(-1);
+    if (f >= 0)
+    {
+        ::close(f);
+    }
+}
+
+bool OnkyoRiClient::write (const std::string & command, Completion completion)
+{
+    std::lock_guard<std::mutex> writeLock(writeMutex);
+    if (!isConnected())
+    {
+        return false;
+    }
+
+    uint16_t sequence;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        sequence = nextSequence++;
+        // The acknowledgement may arrive before the write returns
+        pending[sequence] = Pending { completion, Clock::now() };
+    }
+
+    char data[16];
+    const int length = ::snprintf(data, sizeof(data), "Nx%04X%s", sequence, command.c_str());
+    int written = 0;
+    while (written < length)
+    {
+        const int f = fd;
+        const ssize_t n = f < 0 ? -1 : ::write(f, data + written, length - written);
+        if (n > 0)
+        {
+            written += n;
+        }
+        else if (n < 0 && (errno == EAGAIN || errno == EINTR))
+        {
+            // Throttled by the flow control
+            pollfd p = { f, POLLOUT, 0 };
+            ::poll(&p, 1, 100);
+        }
+        else
+        {
+            // The reader thread detects the lost port and completes the command
+            break;
+        }
+    }
+    return true;
+}
+
+void OnkyoRiClient::run ()
+{
+    Clock::time_point nextOpen = Clock::now();
+    bool connected = isConnected();
+    if (connected && connectionHandler)
+    {
+        connectionHandler(true);
+    }
+    while (running)
+    {
+        if (!isConnected())
+        {
+            if (Clock::now() >= nextOpen && open())
+            {
+                connected = true;
+                if (connectionHandler)
+                {
+                    connectionHandler(true);
+                }
+            }
+            else
+            {
+                if (Clock::now() >= nextOpen)
+                {
+                    nextOpen = Clock::now() + std::chrono::milliseconds(RECONNECT_INTERVAL);
+                }
+                std::this_thread::sleep_for(std::chrono::milliseconds(100));
+                completeAll(Status::TIMEOUT, true);
+                continue;
+            }
+        }
+
+        pollfd p = { fd, POLLIN, 0 };
+        const int res = ::poll(&p, 1, 100);
+        bool lost = res > 0 && (p.revents & (POLLERR | POLLHUP | POLLNVAL));
+        if (res > 0 && (p.revents & POLLIN))
+        {
+            char buffer[256];
+            const ssize_t n = ::read(fd, buffer, sizeof(buffer));
+            if (n > 0)
+            {
+                for (ssize_t i = 0; i < n; i++)
+                {
+                    if (buffer[i] == '\n')
+                    {
+                        processLine(line);
+                        line.clear();
+                    }
+                    else if (buffer[i] != '\r')
+                    {
+                        line += buffer[i];
+                    }
+                }
+                lost = false;
+            }
+            else
+            {
+                lost = n == 0 || (errno != EAGAIN && errno != EINTR);
+            }
+        }
+        if (lost)
+        {
+            close();
+            completeAll(Status::DISCONNECTED, false);
+            nextOpen = Clock::now() + std::chrono::milliseconds(RECONNECT_INTERVAL);
+            if (connected && connectionHandler)
+            {
+                connectionHandler(false);
+            }
+            connected = false;
+        }
+        completeAll(Status::TIMEOUT, true);
+    }
+}
+
+void OnkyoRiClient::processLine (const std::string & text)
+{
+    static const std::regex portPattern("RI([0-9]): ");
+    static const std::regex ackPattern("ACK 0x([0-9a-f]+) (queued|done|rejected|dropped)");
+    static const std::regex framePattern(" = 0x([0-9a-f]+)( echo|, corrupted echo)?");
+
+    if (lineHandler)
+    {
+        lineHandler(text);
+    }
+
+    // The frame is logged in parts: "RI<p>: " at its start and " = <code>" at its end, other
+    // messages may be written in between
+    std::smatch m;
+    if (std::regex_search(text, m, portPattern))
+    {
+        lastPort = std::stoi(m[1]);
+    }
+    if (std::regex_search(text, m, ackPattern))
+    {
+        const uint16_t sequence = uint16_t(std::stoul(m[1], nullptr, 16));
+        if (m[2] == "done")
+        {
+            complete(sequence, Status::DONE);
+        }
+        else if (m[2] == "rejected")
+        {
+            complete(sequence, Status::REJECTED);
+        }
+        else if (m[2] == "dropped")
+        {
+            complete(sequence, Status::DROPPED);
+        }
+    }
+    if (std::regex_search(text, m, framePattern) && lastPort >= 0)
+    {
+        Frame frame { unsigned(lastPort), uint32_t(std::stoul(m[1], nullptr, 16)), FrameType::FOREIGN, Clock::now() };
+        if (m[2] == " echo")
+        {
+            frame.type = FrameType::OWN;
+        }
+        else if (m[2].matched)
+        {
+            frame.type = FrameType::OWN_CORRUPTED;
+        }
+        lastPort = -1;
+        if (frameHandler)
+        {
+            frameHandler(frame);
+        }
+    }
+}
+
+void OnkyoRiClient::complete (uint16_t sequence, Status status)
+{
+    Pending p;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        auto it = pending.find(sequence);
+        if (it == pending.end())
+        {
+            return;
+        }
+        p = it->second;
+        pending.erase(it);
+    }
+    if (p.completion)
+    {
+        p.completion(status, Clock::now() - p.sent);
+    }
+}
+
+void OnkyoRiClient::completeAll (Status status, bool expiredOnly)
+{
+    std::vector<Pending> completed;
+    const Clock::time_point now = Clock::now();
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        for (auto it = pending.begin(); it != pending.end();)
+        {
+            if (!expiredOnly || now - it->second.sent >= timeout)
+            {
+                completed.push_back(it->second);
+                it = pending.erase(it);
+            }
+            else
+            {
+                ++it;
+            }
+        }
+    }
+    for (const Pending & p : completed)
+    {
+        if (p.completion)
+        {
+            p.completion(status, now - p.sent);
+        }
+    }
+}
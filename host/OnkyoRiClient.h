@@ -0,0 +1,181 @@
+/*
+ * onkyoUsbRi: Onkyo RI control
+ *
+ * Copyright (C) 2021. Mikhail Kulesh
+ *
+ * This program is free software: you can redistribute it and/or modify it under the terms of the GNU
+ * General Public License as published by the Free Software Foundation, either version 3 of the License,
+ * or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without
+ * even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details. You should have received a copy of the GNU General
+ * Public License along with this program.
+ */
+
+#ifndef ONKYO_RI_CLIENT_H_
+#define ONKYO_RI_CLIENT_H_
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+
+namespace OnkyoRiHost
+{
+
+/**
+ * @brief Linux client of the adapter protocol on a serial port.
+ *
+ * Each command is sent with a sequence ID ("Nx<ssss>"), and its completion callback is called with
+ * the final acknowledgement of the adapter: done, rejected or dropped. A command without a final
+ * acknowledgement within the timeout, or pending while the connection is lost, is completed with
+ * TIMEOUT or DISCONNECTED.
+ *
+ * The received log lines are parsed into RI frames (own echoes are tagged) and passed to the frame
+ * handler; all lines are passed to the line handler. The port is reopened when it disappears, for
+ * example when the adapter is unplugged.
+ *
+ * All handlers are called from the reader thread of the client; they shall not block and may call
+ * send().
+ */
+class OnkyoRiClient
+{
+public:
+
+    typedef std::chrono::steady_clock Clock;
+
+    enum class Status
+    {
+        DONE = 0,
+        REJECTED = 1,
+        DROPPED = 2,
+        TIMEOUT = 3,
+        DISCONNECTED = 4
+    };
+
+    enum class FrameType
+    {
+        FOREIGN = 0,
+        OWN = 1, // echo of an own transmission
+        OWN_CORRUPTED = 2
+    };
+
+    struct Frame
+    {
+        unsigned port;
+        uint32_t code;
+        FrameType type;
+        Clock::time_point time;
+    };
+
+    typedef std::function<void (Status status, Clock::duration latency)> Completion;
+    typedef std::function<void (const Frame & frame)> FrameHandler;
+    typedef std::function<void (const std::string & line)> LineHandler;
+    typedef std::function<void (bool connected)> ConnectionHandler;
+
+    static const unsigned PORTS_COUNT = 4;
+    static const uint32_t MAX_ARGUMENT = 0xFFFF;
+    static const unsigned TX_QUEUE_SIZE = 4; // frames the adapter accepts per port
+
+    /**
+     * @brief Client of the adapter on the given serial device. With flow control, the port is
+     * opened with RTS/CTS (firmware built with USART_FLOW_CONTROL).
+     */
+    OnkyoRiClient (const std::string & _path, bool _flowControl = false);
+    ~OnkyoRiClient ();
+
+    /**
+     * @brief Open the port and start the reader thread.
+     *
+     * @return true if the port could be opened now; otherwise, it is reopened in the background.
+     */
+    bool start ();
+    void stop ();
+
+    /**
+     * @brief Queue the RI code for the given port.
+     *
+     * @return false if the adapter is not connected: the completion is not called.
+     */
+    bool send (unsigned port, uint32_t code, Completion completion);
+
+    /**
+     * @brief Send a service command, for example 'S' with the argument 0 for the statistics report.
+     */
+    bool sendCommand (char opcode, uint32_t argument, Completion completion);
+
+    inline void setFrameHandler (FrameHandler handler)
+    {
+        frameHandler = handler;
+    }
+
+    inline void setLineHandler (LineHandler handler)
+    {
+        lineHandler = handler;
+    }
+
+    inline void setConnectionHandler (ConnectionHandler handler)
+    {
+        connectionHandler = handler;
+    }
+
+    inline void setTimeout (Clock::duration _timeout)
+    {
+        timeout = _timeout;
+    }
+
+    inline bool isConnected () const
+    {
+        return fd >= 0;
+    }
+
+    /**
+     * @brief Number of commands sent and not completed yet.
+     */
+    size_t getPending ();
+
+    static const char * toString (Status status);
+
+private:
+
+    struct Pending
+    {
+        Completion completion;
+        Clock::time_point sent;
+    };
+
+    static const int RECONNECT_INTERVAL = 500; // ms
+
+    const std::string path;
+    const bool flowControl;
+    std::atomic<int> fd;
+    std::atomic<bool> running;
+    std::thread reader;
+    std::mutex mutex; // pending commands
+    std::mutex writeMutex; // the sequence ID applies to the next command: no interleaved writes
+    std::map<uint16_t, Pending> pending;
+    uint16_t nextSequence;
+    Clock::duration timeout;
+    int lastPort;
+    std::string line;
+
+    FrameHandler frameHandler;
+    LineHandler lineHandler;
+    ConnectionHandler connectionHandler;
+
+    bool open ();
+    void close ();
+    bool write (const std::string & command, Completion completion);
+    void run ();
+    void processLine (const std::string & line);
+    void complete (uint16_t sequence, Status status);
+    void completeAll (Status status, bool expiredOnly);
+};
+
+} // end namespace
+#endif
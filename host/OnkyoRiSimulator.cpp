@@ -0,0 +1,261 @@
+/*
+ * onkyoUsbRi: Onkyo RI control
+ *
+ * Copyright (C) 2021. Mikhail Kulesh
+ *
+ * This program is free software: you can redistribute it and/or modify it under the terms of the GNU
+ * General Public License as published by the Free Software Foundation, either version 3 of the License,
+ * or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without
+ * even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details. You should have received a copy of the GNU General
+ * Public License along with this program.
+ */
+
+#include "OnkyoRiSimulator.h"
+
+#include <bitset>
+#include <cerrno>
+#include <cstdarg>
+#include <cstdio>
+#include <cstdlib>
+#include <fcntl.h>
+#include <poll.h>
+#include <termios.h>
+#include <unistd.h>
+
+using namespace OnkyoRiHost;
+
+/************************************************************************
+ * Class OnkyoRiSimulator
+ ************************************************************************/
+
+OnkyoRiSimulator::OnkyoRiSimulator (unsigned _idleGap) :
+    idleGap { _idleGap },
+    master { -1 },
+    running { false },
+    sequence { NO_SEQUENCE },
+    commands { 0 },
+    invalidCommands { 0 },
+    frames { 0 }
+{
+    for (Port & p : ports)
+    {
+        p.busy = false;
+    }
+}
+
+OnkyoRiSimulator::~OnkyoRiSimulator ()
+{
+    stop();
+}
+
+bool OnkyoRiSimulator::start ()
+{
+    if (running)
+    {
+        return true;
+    }
+    master = ::posix_openpt(O_RDWR | O_NOCTTY | O_NONBLOCK);
+    if (master < 0)
+    {
+        return false;
+    }
+    const char * name = ::grantpt(master) == 0 && ::unlockpt(master) == 0 ? ::ptsname(master) : NULL;
+    if (name == NULL)
+    {
+        ::close(master);
+        master = -1;
+        return false;
+    }
+    path = name;
+
+    // The adapter does not echo the commands
+    termios attr;
+    if (::tcgetattr(master, &attr) == 0)
+    {
+        ::cfmakeraw(&attr);
+        ::tcsetattr(master, TCSANOW, &attr);
+    }
+
+    started = Clock::now();
+    running = true;
+    worker = std::thread(&OnkyoRiSimulator::run, this);
+    return true;
+}
+
+void OnkyoRiSimulator::stop ()
+{
+    if (!running)
+    {
+        return;
+    }
+    running = false;
+    worker.join();
+    ::close(master);
+    master = -1;
+}
+
+std::chrono::microseconds OnkyoRiSimulator::getFrameTime (uint32_t code)
+{
+    // Header 3 + 1 ms, bits 1 + 1 or 1 + 2 ms, trailer 1 + 1 ms
+    const std::bitset<12> bits(code);
+    return std::chrono::milliseconds(4 + 2 * bits.size() + bits.count() + 2);
+}
+
+void OnkyoRiSimulator::run ()
+{
+    while (running)
+    {
+        // Sleep until the next frame ends or a command arrives
+        Clock::time_point now = Clock::now();
+        Clock::time_point next = now + std::chrono::milliseconds(100);
+        for (const Port & p : ports)
+        {
+            if (p.busy && p.done < next)
+            {
+                next = p.done;
+            }
+            else if (!p.busy && !p.txQueue.empty() && p.idle < next)
+            {
+                next = p.idle;
+            }
+        }
+        const auto wait = std::chrono::duration_cast<std::chrono::milliseconds>(next - now).count();
+        pollfd p = { master, POLLIN, 0 };
+        const int res = ::poll(&p, 1, wait > 0 ? int(wait) : 0);
+        if (res > 0 && (p.revents & POLLIN))
+        {
+            char buffer[64];
+            const ssize_t n = ::read(master, buffer, sizeof(buffer));
+            for (ssize_t i = 0; i < n; i++)
+            {
+                command += buffer[i];
+                if (command.size() == CMD_LENGTH)
+                {
+                    processCommand();
+                    command.clear();
+                }
+            }
+        }
+        else if (res > 0)
+        {
+            // No client has the slave side open
+            std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        }
+        processPorts(Clock::now());
+    }
+}
+
+void OnkyoRiSimulator::processCommand ()
+{
+    commands++;
+    char opcode = '0';
+    std::string hex = command;
+    if (command[1] == 'x')
+    {
+        opcode = command[0];
+        hex = command.substr(2);
+    }
+    char * end = NULL;
+    const uint32_t argument = uint32_t(::strtoul(hex.c_str(), &end, 16));
+    const bool valid = end != NULL && *end == 0 && hex.find_first_of("+- ") == std::string::npos;
+
+    if (valid && opcode == 'N')
+    {
+        sequence = int32_t(argument);
+        return;
+    }
+
+    // The sequence ID applies to the next command only
+    const int32_t s = sequence;
+    sequence = NO_SEQUENCE;
+    if (valid && opcode >= '0' && opcode <= '9' && unsigned(opcode - '0') < PORTS_COUNT)
+    {
+        Port & port = ports[opcode - '0'];
+        print("\nUSART: 0x%x -> RI%c\n", argument, opcode);
+        if (port.txQueue.size() >= TX_QUEUE_SIZE)
+        {
+            acknowledge(s, "rejected");
+            return;
+        }
+        port.txQueue.push_back(TxRequest { argument, s });
+        acknowledge(s, "queued");
+    }
+    else if (valid && opcode == 'S')
+    {
+        const auto up = std::chrono::duration_cast<std::chrono::milliseconds>(Clock::now() - started).count();
+        print("\nSTAT: up=%lld usart=%u,%u frames=%u\n", (long long) up, commands, invalidCommands, frames);
+        acknowledge(s, "done");
+    }
+    else
+    {
+        invalidCommands++;
+        print("\nUSART: invalid command\n");
+        acknowledge(s, "rejected");
+    }
+}
+
+void OnkyoRiSimulator::processPorts (Clock::time_point now)
+{
+    for (unsigned id = 0; id < PORTS_COUNT; id++)
+    {
+        Port & p = ports[id];
+        if (p.busy && now >= p.done)
+        {
+            // The receiver decodes the own transmission
+            p.busy = false;
+            p.idle = p.done + std::chrono::milliseconds(idleGap);
+            frames++;
+            print("RI%u:  = 0x%x echo\n", id, p.current.code & 0xFFF);
+            acknowledge(p.current.sequence, "done");
+        }
+        if (!p.busy && !p.txQueue.empty() && now >= p.idle)
+        {
+            p.current = p.txQueue.front();
+            p.txQueue.pop_front();
+            p.busy = true;
+            p.done = now + getFrameTime(p.current.code);
+        }
+    }
+}
+
+void OnkyoRiSimulator::acknowledge (int32_t s, const char * status)
+{
+    if (s != NO_SEQUENCE)
+    {
+        print("ACK 0x%x %s\n", s, status);
+    }
+}
+
+void OnkyoRiSimulator::print (const char * format, ...)
+{
+    char buffer[128];
+    va_list args;
+    va_start(args, format);
+    const int length = ::vsnprintf(buffer, sizeof(buffer), format, args);
+    va_end(args);
+    int written = 0;
+    while (written < length && running)
+    {
+        const ssize_t n = ::write(master, buffer + written, length - written);
+        if (n > 0)
+        {
+            written += n;
+        }
+        else if (n < 0 && (errno == EAGAIN || errno == EINTR))
+        {
+            // The client does not read: the output is lost like on a disconnected USART
+            pollfd p = { master, POLLOUT, 0 };
+            if (::poll(&p, 1, 100) <= 0)
+            {
+                break;
+            }
+        }
+        else
+        {
+            break;
+        }
+    }
+}
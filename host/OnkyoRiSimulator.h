@@ -0,0 +1,109 @@
+/*
+ * onkyoUsbRi: Onkyo RI control
+ *
+ * Copyright (C) 2021. Mikhail Kulesh
+ *
+ * This program is free software: you can redistribute it and/or modify it under the terms of the GNU
+ * General Public License as published by the Free Software Foundation, either version 3 of the License,
+ * or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without
+ * even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details. You should have received a copy of the GNU General
+ * Public License along with this program.
+ */
+
+#ifndef ONKYO_RI_SIMULATOR_H_
+#define ONKYO_RI_SIMULATOR_H_
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <deque>
+#include <string>
+#include <thread>
+
+namespace OnkyoRiHost
+{
+
+/**
+ * @brief Simulation of the adapter behind a pseudo-terminal.
+ *
+ * The simulator accepts the commands of the firmware (6 characters, "Nx<ssss>" sequence IDs), queues
+ * the RI codes per port and transmits them with the frame timing of OnkyoRiOutputProcessor: every
+ * frame waits for the idle gap since the previous one, then the echo and the final acknowledgement
+ * are written like the firmware does. Only the port commands and 'S' are simulated; the other
+ * service commands are rejected.
+ */
+class OnkyoRiSimulator
+{
+public:
+
+    static const unsigned PORTS_COUNT = 4;
+    static const size_t TX_QUEUE_SIZE = 4;
+    static const unsigned DEFAULT_IDLE_GAP = 20; // ms, OnkyoRiPort::DEFAULT_IDLE_GAP
+
+    OnkyoRiSimulator (unsigned _idleGap = DEFAULT_IDLE_GAP);
+    ~OnkyoRiSimulator ();
+
+    /**
+     * @brief Create the pseudo-terminal and start the simulation thread.
+     */
+    bool start ();
+    void stop ();
+
+    /**
+     * @brief Path of the slave side of the pseudo-terminal to be opened by the client.
+     */
+    inline const std::string & getPath () const
+    {
+        return path;
+    }
+
+    /**
+     * @brief Duration of the frame with the given code: header, 12 bits and trailer.
+     */
+    static std::chrono::microseconds getFrameTime (uint32_t code);
+
+private:
+
+    typedef std::chrono::steady_clock Clock;
+
+    static const int32_t NO_SEQUENCE = -1;
+    static const size_t CMD_LENGTH = 6;
+
+    struct TxRequest
+    {
+        uint32_t code;
+        int32_t sequence;
+    };
+
+    struct Port
+    {
+        std::deque<TxRequest> txQueue;
+        bool busy;
+        TxRequest current;
+        Clock::time_point done; // end of the current frame
+        Clock::time_point idle; // the next frame may start
+    };
+
+    const unsigned idleGap;
+    int master;
+    std::string path;
+    std::atomic<bool> running;
+    std::thread worker;
+    Port ports[PORTS_COUNT];
+    std::string command;
+    int32_t sequence;
+    uint32_t commands, invalidCommands, frames;
+    Clock::time_point started;
+
+    void run ();
+    void processCommand ();
+    void processPorts (Clock::time_point now);
+    void acknowledge (int32_t sequence, const char * status);
+    void print (const char * format, ...);
+};
+
+} // end namespace
+#endif
@@ -0,0 +1,279 @@
+/*
+ * onkyoUsbRi: Onkyo RI control
+ *
+ * Copyright (C) 2021. Mikhail Kulesh
+ *
+ * This program is free software: you can redistribute it and/or modify it under the terms of the GNU
+ * General Public License as published by the Free Software Foundation, either version 3 of the License,
+ * or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without
+ * even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details. You should have received a copy of the GNU General
+ * Public License along with this program.
+ */
+
+/*
+ * Benchmark of the firmware RI input decoders on noisy traces: edge interrupts (default build)
+ * against the oversampled majority vote (firmware built with RI_SAMPLED_INPUT).
+ *
+ * Usage:
+ *     decoderbench [frames] [noise rates per second, comma separated] [seed]
+ *
+ *     frames: number of frames (default 100), noise rates: default 0,1000,5000,20000,50000
+ *
+ * A trace of random RI frames (pulse widths +/- 3 %) is disturbed by spikes of random width (1...50 us)
+ * at the given rates. The decoders of the firmware are compiled for the host: OnkyoRiInputProcessor
+ * gets every toggle of the trace as an edge interrupt (no edge is lost, as if the interrupt took no
+ * time), or the edges of the SampleVoter that decodes the trace sampled at 50 kHz in blocks of
+ * SampledInput::BLOCK_SAMPLES. The frames are assembled as in the main loop, without the frame timeout.
+ *
+ * The decoding is repeated until it took 200 ms, and the host time per interrupt (edge or DMA block)
+ * and per second of the trace is reported. The host times do not give the cycles on the target, but
+ * they compare both decoders on the same traces; irq/s is the interrupt rate on the target.
+ *
+ * Build:
+ *     g++ -std=c++14 -O2 -DRI_SAMPLED_INPUT -Isrc/src host/decoderbench.cpp src/src/OnkyoRiInput.cpp \
+ *         src/src/SampleVoter.cpp -o decoderbench
+ */
+
+#include "OnkyoRiInput.h"
+#include "SampleVoter.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <map>
+#include <random>
+#include <string>
+#include <vector>
+
+using namespace StmPlusPlus;
+
+typedef std::chrono::steady_clock Clock;
+
+static const double TICK = 10.0; // us per RX timer tick
+static const size_t BLOCK_SAMPLES = 64; // SampledInput::BLOCK_SAMPLES
+static const double SAMPLE_PERIOD = SampleVoter::TICKS_PER_SAMPLE * TICK; // us
+static const uint16_t PIN = 0x0002; // PB1, the line of the port 0
+static const double MIN_RUN_TIME = 0.2; // s
+
+struct Trace
+{
+    std::vector<uint32_t> codes;
+    std::vector<double> toggles; // us, the line is idle high before the first toggle
+    double end;
+};
+
+struct Result
+{
+    std::vector<uint32_t> frames;
+    uint32_t glitches, interrupts, edges;
+    double ns; // host time of one decoding of the trace
+};
+
+/**
+ * @brief Decoder of the port 0 and the frame assembly of the main loop.
+ */
+struct Receiver
+{
+    OnkyoRiStatistics statistics;
+    OnkyoRiInputProcessor processor;
+    std::vector<uint32_t> & frames;
+    uint32_t edges;
+
+    Receiver (std::vector<uint32_t> & _frames) :
+        statistics { },
+        processor { statistics },
+        frames { _frames },
+        edges { 0 }
+    {
+        // empty
+    }
+
+    inline void processEdge (bool level, uint32_t now)
+    {
+        edges++;
+        const int val = processor.processPinIrq(level, now);
+        if (val == 2)
+        {
+            processor.processMsgStart();
+        }
+        else if (val >= 0 && processor.processMsgBit(val == 1))
+        {
+            frames.push_back(processor.command);
+        }
+    }
+
+    static void onSampledEdge (void * context, uint8_t, bool level, uint32_t time)
+    {
+        ((Receiver *) context)->processEdge(level, time);
+    }
+};
+
+static Trace makeTrace (unsigned frames, unsigned noise, std::mt19937 & rnd)
+{
+    Trace trace;
+    std::uniform_int_distribution<uint32_t> code(1, 0xFFF);
+    std::uniform_real_distribution<double> jitter(0.97, 1.03), gap(20000, 60000), width(1, 50);
+    double t = 10000;
+    auto pulse = [&] (double low, double high)
+    {
+        trace.toggles.push_back(t);
+        t += low * jitter(rnd);
+        trace.toggles.push_back(t);
+        t += high * jitter(rnd);
+    };
+    for (unsigned i = 0; i < frames; i++)
+    {
+        trace.codes.push_back(code(rnd));
+        pulse(3000, 1000);
+        for (int b = 11; b >= 0; b--)
+        {
+            pulse(1000, ((trace.codes.back() >> b) & 1) ? 2000 : 1000);
+        }
+        pulse(1000, gap(rnd));
+    }
+    trace.end = t;
+
+    // A spike inverts the line for its width: overlapping spikes are still described by toggles
+    if (noise > 0)
+    {
+        std::exponential_distribution<double> interval(noise / 1e6);
+        for (double s = interval(rnd); s < trace.end; s += interval(rnd))
+        {
+            trace.toggles.push_back(s);
+            trace.toggles.push_back(s + width(rnd));
+        }
+        std::sort(trace.toggles.begin(), trace.toggles.end());
+    }
+    return trace;
+}
+
+static std::vector<uint16_t> makeSamples (const Trace & trace, double phase)
+{
+    std::vector<uint16_t> samples;
+    size_t idx = 0;
+    for (double t = phase; t < trace.end; t += SAMPLE_PERIOD)
+    {
+        while (idx < trace.toggles.size() && trace.toggles[idx] <= t)
+        {
+            idx++;
+        }
+        samples.push_back((idx & 1) ? 0 : PIN);
+    }
+    samples.resize(samples.size() - samples.size() % BLOCK_SAMPLES);
+    return samples;
+}
+
+static Result runEdge (const Trace & trace)
+{
+    Result r;
+    unsigned runs = 0;
+    const Clock::time_point start = Clock::now();
+    do
+    {
+        r.frames.clear();
+        Receiver receiver(r.frames);
+        for (size_t i = 0; i < trace.toggles.size(); i++)
+        {
+            receiver.processEdge((i & 1) != 0, uint32_t(trace.toggles[i] / TICK));
+        }
+        r.glitches = receiver.statistics.rxGlitches;
+        r.edges = receiver.edges;
+        runs++;
+    }
+    while (Clock::now() - start < std::chrono::duration<double>(MIN_RUN_TIME));
+    r.ns = std::chrono::duration<double, std::nano>(Clock::now() - start).count() / runs;
+    r.interrupts = uint32_t(trace.toggles.size());
+    return r;
+}
+
+static Result runSampled (const std::vector<uint16_t> & samples, double phase)
+{
+    Result r;
+    unsigned runs = 0;
+    const Clock::time_point start = Clock::now();
+    do
+    {
+        r.frames.clear();
+        Receiver receiver(r.frames);
+        SampleVoter voter;
+        voter.setChannel(0, PIN);
+        voter.setEdgeHandler(Receiver::onSampledEdge, &receiver);
+        voter.startVoting(PIN, uint32_t(phase / TICK));
+        for (size_t i = 0; i < samples.size(); i += BLOCK_SAMPLES)
+        {
+            voter.processBlock(&samples[i], BLOCK_SAMPLES);
+        }
+        r.glitches = receiver.statistics.rxGlitches;
+        r.edges = receiver.edges;
+        r.interrupts = voter.getBlocks();
+        runs++;
+    }
+    while (Clock::now() - start < std::chrono::duration<double>(MIN_RUN_TIME));
+    r.ns = std::chrono::duration<double, std::nano>(Clock::now() - start).count() / runs;
+    return r;
+}
+
+static void printResult (unsigned rate, const char * name, const Trace & trace, const Result & r)
+{
+    std::map<uint32_t, int> sent;
+    for (uint32_t c : trace.codes)
+    {
+        sent[c]++;
+    }
+    unsigned ok = 0;
+    for (uint32_t c : r.frames)
+    {
+        if (sent[c] > 0)
+        {
+            sent[c]--;
+            ok++;
+        }
+    }
+    const double seconds = trace.end / 1e6;
+    printf("%8u %-8s %5u %5zu %5zu %8u %8u %8.0f %10.1f %10.0f\n", rate, name, ok, r.frames.size() - ok,
+           trace.codes.size() - ok, r.glitches, r.edges, r.interrupts / seconds, r.ns / r.interrupts,
+           r.ns / seconds);
+}
+
+int main (int argc, char ** argv)
+{
+    const unsigned frames = argc > 1 ? unsigned(::strtoul(argv[1], NULL, 10)) : 100;
+    std::vector<unsigned> rates;
+    if (argc > 2)
+    {
+        std::string list = argv[2];
+        for (size_t pos = 0; pos != std::string::npos;)
+        {
+            const size_t next = list.find(',', pos);
+            rates.push_back(unsigned(::strtoul(list.substr(pos, next - pos).c_str(), NULL, 10)));
+            pos = next == std::string::npos ? next : next + 1;
+        }
+    }
+    else
+    {
+        rates = { 0, 1000, 5000, 20000, 50000 };
+    }
+    const unsigned seed = argc > 3 ? unsigned(::strtoul(argv[3], NULL, 10)) : 1;
+    if (frames == 0)
+    {
+        fprintf(stderr, "Usage: %s [frames] [noise rates per second, comma separated] [seed]\n", argv[0]);
+        return 1;
+    }
+
+    printf("%8s %-8s %5s %5s %5s %8s %8s %8s %10s %10s\n", "noise/s", "decoder", "ok", "bad", "lost",
+           "glitches", "edges", "irq/s", "ns/irq", "ns/s");
+    for (unsigned rate : rates)
+    {
+        std::mt19937 rnd(seed);
+        const Trace trace = makeTrace(frames, rate, rnd);
+        const double phase = std::uniform_real_distribution<double>(0, SAMPLE_PERIOD)(rnd);
+        const std::vector<uint16_t> samples = makeSamples(trace, phase);
+        printResult(rate, "edge", trace, runEdge(trace));
+        printResult(rate, "sampled", trace, runSampled(samples, phase));
+    }
+    return 0;
+}
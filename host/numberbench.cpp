@@ -0,0 +1,145 @@
+/*
+ * onkyoUsbRi: Onkyo RI control
+ *
+ * Copyright (C) 2021. Mikhail Kulesh
+ *
+ * This program is free software: you can redistribute it and/or modify it under the terms of the GNU
+ * General Public License as published by the Free Software Foundation, either version 3 of the License,
+ * or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without
+ * even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details. You should have received a copy of the GNU General
+ * Public License along with this program.
+ */
+
+/*
+ * Micro-benchmark of the number formatter of UsartLogger.
+ *
+ * Usage:
+ *     numberbench [count]
+ *
+ *     count: numbers per case (default 1000000)
+ *
+ * The firmware formatter (NumberFormat) is compiled for the host and timed against snprintf on the
+ * same random numbers: 32-bit and 64-bit decimal, negative, hex and zero-padded values. Each output is
+ * compared with the snprintf output first. The host times do not give the cycles on the target, but
+ * they show the relative cost of the cases, for example of the 64-bit division.
+ *
+ * Build:
+ *     g++ -std=c++14 -O2 -Isrc/src host/numberbench.cpp src/src/NumberFormat.cpp -o numberbench
+ */
+
+#include "NumberFormat.h"
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <random>
+#include <vector>
+
+using namespace StmPlusPlus;
+
+typedef std::chrono::steady_clock Clock;
+
+struct Case
+{
+    const char * name;
+    uint32_t radix;
+    uint8_t width;
+    char fill;
+    bool negative;
+    uint64_t mask;
+};
+
+static const Case CASES[] = {
+    { "dec 16 bit", 10, 0, ' ', false, 0xFFFF },
+    { "dec 32 bit", 10, 0, ' ', false, 0xFFFFFFFF },
+    { "dec 64 bit", 10, 0, ' ', false, ~uint64_t(0) },
+    { "dec negative", 10, 0, ' ', true, 0x7FFFFFFF },
+    { "dec width 8", 10, 8, ' ', false, 0xFFFF },
+    { "hex 32 bit", 16, 0, ' ', false, 0xFFFFFFFF },
+    { "hex zero fill 6", 16, 6, '0', false, 0xFFF },
+};
+
+static void toString (const Case & c, uint64_t n, char * out, size_t size)
+{
+    const unsigned long long v = n;
+    const int width = c.width < NumberFormat::BUFFER_SIZE ? c.width : 0;
+    if (c.radix == 16)
+    {
+        ::snprintf(out, size, c.fill == '0' ? "0x%0*llx" : "0x%*llx", width > 2 ? width - 2 : 0, v);
+    }
+    else if (c.negative)
+    {
+        ::snprintf(out, size, "%*lld", width, -(long long) v);
+    }
+    else
+    {
+        ::snprintf(out, size, c.fill == '0' ? "%0*llu" : "%*llu", width, v);
+    }
+}
+
+template<typename Function>
+static double measure (const std::vector<uint64_t> & numbers, Function function)
+{
+    // The first character of each result is accumulated, so the calls are not optimized away
+    volatile char sink = 0;
+    const Clock::time_point start = Clock::now();
+    for (uint64_t n : numbers)
+    {
+        sink = sink + function(n);
+    }
+    return std::chrono::duration<double, std::nano>(Clock::now() - start).count() / numbers.size();
+}
+
+int main (int argc, char ** argv)
+{
+    const size_t count = argc > 1 ? size_t(::strtoul(argv[1], NULL, 10)) : 1000000;
+    if (count == 0)
+    {
+        fprintf(stderr, "Usage: %s [count]\n", argv[0]);
+        return 1;
+    }
+
+    std::mt19937_64 rnd(1);
+    bool passed = true;
+    printf("%-16s %12s %12s\n", "case", "format ns", "snprintf ns");
+    for (const Case & c : CASES)
+    {
+        std::vector<uint64_t> numbers(count);
+        for (uint64_t & n : numbers)
+        {
+            n = rnd() & c.mask;
+        }
+
+        for (uint64_t n : numbers)
+        {
+            char buffer[NumberFormat::BUFFER_SIZE], expected[32];
+            const char * text = NumberFormat::format(buffer, n, c.negative, c.radix, c.width, c.fill);
+            toString(c, n, expected, sizeof(expected));
+            if (::strcmp(text, expected) != 0)
+            {
+                printf("%s: %s instead of %s\n", c.name, text, expected);
+                passed = false;
+                break;
+            }
+        }
+
+        const double formatTime = measure(numbers, [&c] (uint64_t n)
+        {
+            char buffer[NumberFormat::BUFFER_SIZE];
+            return NumberFormat::format(buffer, n, c.negative, c.radix, c.width, c.fill)[0];
+        });
+        const double snprintfTime = measure(numbers, [&c] (uint64_t n)
+        {
+            char buffer[32];
+            toString(c, n, buffer, sizeof(buffer));
+            return buffer[0];
+        });
+        printf("%-16s %12.1f %12.1f\n", c.name, formatTime, snprintfTime);
+    }
+    printf("%s\n", passed ? "PASSED" : "FAILED");
+    return passed ? 0 : 2;
+}
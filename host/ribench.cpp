@@ -0,0 +1,192 @@
+/*
+ * onkyoUsbRi: Onkyo RI control
+ *
+ * Copyright (C) 2021. Mikhail Kulesh
+ *
+ * This program is free software: you can redistribute it and/or modify it under the terms of the GNU
+ * General Public License as published by the Free Software Foundation, either version 3 of the License,
+ * or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without
+ * even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details. You should have received a copy of the GNU General
+ * Public License along with this program.
+ */
+
+/*
+ * Latency and throughput benchmark of the adapter protocol.
+ *
+ * Usage:
+ *     ribench <device>|--sim [count] [port] [code]
+ *
+ *     device: serial device of the adapter, for example /dev/ttyACM0; --sim runs against the
+ *     simulated adapter on a pseudo-terminal. count: commands per test (default 50), port: RI port
+ *     (default 0), code: RI code in hex (default 0x20).
+ *
+ * The latency test sends the commands one by one and measures the round trip from the write to the
+ * final acknowledgement, which includes the frame time (30...42 ms depending on the code). The
+ * throughput test keeps the TX queue of the port full and reports the sustained frame rate.
+ */
+
+#include "OnkyoRiClient.h"
+#include "OnkyoRiSimulator.h"
+
+#include <algorithm>
+#include <condition_variable>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+
+using namespace OnkyoRiHost;
+
+typedef OnkyoRiClient::Clock Clock;
+
+struct Results
+{
+    std::vector<double> latencies; // ms
+    unsigned statuses[5];
+    unsigned echoes, corrupted;
+    double seconds;
+
+    Results () : statuses { 0 }, echoes { 0 }, corrupted { 0 }, seconds { 0 }
+    {
+        // empty
+    }
+};
+
+static std::mutex mutex;
+static std::condition_variable completed;
+static Results * results = NULL;
+static unsigned outstanding = 0;
+
+static void onCompletion (OnkyoRiClient::Status status, Clock::duration latency)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    results->statuses[int(status)]++;
+    if (status == OnkyoRiClient::Status::DONE)
+    {
+        results->latencies.push_back(std::chrono::duration<double, std::milli>(latency).count());
+    }
+    outstanding--;
+    completed.notify_all();
+}
+
+static void onFrame (const OnkyoRiClient::Frame & frame)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    if (results != NULL && frame.type == OnkyoRiClient::FrameType::OWN)
+    {
+        results->echoes++;
+    }
+    else if (results != NULL && frame.type == OnkyoRiClient::FrameType::OWN_CORRUPTED)
+    {
+        results->corrupted++;
+    }
+}
+
+/**
+ * @brief Send count commands with at most window commands in flight.
+ */
+static void runTest (OnkyoRiClient & client, Results & r, unsigned count, unsigned window, unsigned port,
+                     uint32_t code)
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        results = &r;
+    }
+    const Clock::time_point start = Clock::now();
+    for (unsigned i = 0; i < count; i++)
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        completed.wait(lock, [window] { return outstanding < window; });
+        outstanding++;
+        lock.unlock();
+        if (!client.send(port, code, onCompletion))
+        {
+            lock.lock();
+            outstanding--;
+            r.statuses[int(OnkyoRiClient::Status::DISCONNECTED)]++;
+        }
+    }
+    std::unique_lock<std::mutex> lock(mutex);
+    completed.wait(lock, [] { return outstanding == 0; });
+    r.seconds = std::chrono::duration<double>(Clock::now() - start).count();
+    // The last echo is logged just before the last acknowledgement
+    results = NULL;
+}
+
+static void printResults (const char * name, Results & r, unsigned count)
+{
+    printf("%s:\n", name);
+    printf("    done=%u rejected=%u dropped=%u timeout=%u disconnected=%u echoes=%u corrupted=%u\n",
+           r.statuses[0], r.statuses[1], r.statuses[2], r.statuses[3], r.statuses[4], r.echoes, r.corrupted);
+    if (!r.latencies.empty())
+    {
+        std::vector<double> & l = r.latencies;
+        std::sort(l.begin(), l.end());
+        double sum = 0;
+        for (double v : l)
+        {
+            sum += v;
+        }
+        const size_t p99 = std::min(l.size() - 1, l.size() * 99 / 100);
+        printf("    latency ms: min=%.2f avg=%.2f p50=%.2f p99=%.2f max=%.2f\n", l.front(), sum / l.size(),
+               l[l.size() / 2], l[p99], l.back());
+    }
+    printf("    %u commands in %.2f s: %.1f frames/s\n", count, r.seconds, r.statuses[0] / r.seconds);
+}
+
+int main (int argc, char ** argv)
+{
+    if (argc < 2 || ::strcmp(argv[1], "-h") == 0 || ::strcmp(argv[1], "--help") == 0)
+    {
+        fprintf(stderr, "Usage: %s <device>|--sim [count] [port] [code]\n", argv[0]);
+        return 1;
+    }
+    const unsigned count = argc > 2 ? unsigned(::strtoul(argv[2], NULL, 10)) : 50;
+    const unsigned port = argc > 3 ? unsigned(::strtoul(argv[3], NULL, 10)) : 0;
+    const uint32_t code = argc > 4 ? uint32_t(::strtoul(argv[4], NULL, 16)) : 0x20;
+    if (count == 0 || port >= OnkyoRiClient::PORTS_COUNT || code > OnkyoRiClient::MAX_ARGUMENT)
+    {
+        fprintf(stderr, "Invalid arguments\n");
+        return 1;
+    }
+
+    OnkyoRiSimulator simulator;
+    std::string device = argv[1];
+    if (device == "--sim")
+    {
+        if (!simulator.start())
+        {
+            fprintf(stderr, "Cannot create the pseudo-terminal\n");
+            return 1;
+        }
+        device = simulator.getPath();
+    }
+
+    OnkyoRiClient client(device);
+    client.setFrameHandler(onFrame);
+    client.setConnectionHandler([&device] (bool connected)
+    {
+        fprintf(stderr, "%s %s\n", device.c_str(), connected ? "connected" : "disconnected");
+    });
+    if (!client.start())
+    {
+        fprintf(stderr, "Cannot open %s\n", device.c_str());
+        return 1;
+    }
+
+    printf("Device %s, RI%u, code 0x%x, %u commands per test\n", device.c_str(), port, code, count);
+    Results latency, throughput;
+    runTest(client, latency, count, 1, port, code);
+    printResults("Round trip (one command in flight)", latency, count);
+    runTest(client, throughput, count, OnkyoRiClient::TX_QUEUE_SIZE, port, code);
+    printResults("Throughput (TX queue full)", throughput, count);
+
+    client.stop();
+    simulator.stop();
+    const bool passed = latency.statuses[0] == count && throughput.statuses[0] == count;
+    printf("%s\n", passed ? "PASSED" : "FAILED");
+    return passed ? 0 : 2;
+}
@@ -0,0 +1,141 @@
+/*
+ * onkyoUsbRi: Onkyo RI control
+ *
+ * Copyright (C) 2021. Mikhail Kulesh
+ *
+ * This program is free software: you can redistribute it and/or modify it under the terms of the GNU
+ * General Public License as published by the Free Software Foundation, either version 3 of the License,
+ * or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without
+ * even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details. You should have received a copy of the GNU General
+ * Public License along with this program.
+ */
+
+#include "AnalogFrontEnd.h"
+
+#ifdef RI_ANALOG_INPUT
+
+using namespace StmPlusPlus;
+
+/************************************************************************
+ * Class AnalogFrontEnd
+ ************************************************************************/
+
+AnalogFrontEnd::AnalogFrontEnd (TimerBase & _timer) :
+    timer { _timer },
+    input { IOPort::A, GPIO_PIN_7, GPIO_MODE_ANALOG },
+    capturePriority { 0 },
+    threshold { DEFAULT_THRESHOLD },
+    hysteresis { DEFAULT_HYSTERESIS },
+    edgeTime { 0 },
+    level { false },
+    automatic { true },
+    lowLevel { 0 },
+    highLevel { 0 }
+{
+    dac.Instance = DAC2;
+    comp.Instance = COMP2;
+    comp.Init.InvertingInput = COMP_INVERTINGINPUT_DAC2_CH1;
+    comp.Init.NonInvertingInput = COMP_NONINVERTINGINPUT_IO1;
+    comp.Init.Output = COMP_OUTPUT_TIM2IC4;
+    comp.Init.OutputPol = COMP_OUTPUTPOL_NONINVERTED;
+    comp.Init.Hysteresis = COMP_HYSTERESIS_NONE;
+    comp.Init.BlankingSrce = COMP_BLANKINGSRCE_NONE;
+    comp.Init.Mode = 0; // the STM32F303x8 comparators only have the high speed mode
+    comp.Init.WindowMode = COMP_WINDOWMODE_DISABLE;
+    comp.Init.TriggerMode = COMP_TRIGGERMODE_NONE;
+}
+
+bool AnalogFrontEnd::start (const InterruptPriority & prio)
+{
+    // Threshold: DAC2 channel 1 is only connected to the comparator, not to its pin
+    __HAL_RCC_DAC2_CLK_ENABLE();
+    DAC_ChannelConfTypeDef dacChannel;
+    dacChannel.DAC_Trigger = DAC_TRIGGER_NONE;
+    dacChannel.DAC_OutputBuffer = DAC_OUTPUTBUFFER_DISABLE;
+    dacChannel.DAC_OutputSwitch = DAC_OUTPUTSWITCH_DISABLE;
+    if (HAL_DAC_Init(&dac) != HAL_OK || HAL_DAC_ConfigChannel(&dac, &dacChannel, DAC_CHANNEL_1) != HAL_OK)
+    {
+        return false;
+    }
+    setDac(false);
+    HAL_DAC_Start(&dac, DAC_CHANNEL_1);
+
+    // Comparator
+    __HAL_RCC_SYSCFG_CLK_ENABLE();
+    if (HAL_COMP_Init(&comp) != HAL_OK || HAL_COMP_Start(&comp) != HAL_OK)
+    {
+        return false;
+    }
+    level = HAL_COMP_GetOutputLevel(&comp) == COMP_OUTPUTLEVEL_HIGH;
+    setDac(level);
+
+    // Both edges of the comparator output are latched by the input capture 4 of the running RX timer
+    TIM_IC_InitTypeDef capture;
+    capture.ICPolarity = TIM_ICPOLARITY_BOTHEDGE;
+    capture.ICSelection = TIM_ICSELECTION_DIRECTTI;
+    capture.ICPrescaler = TIM_ICPSC_DIV1;
+    capture.ICFilter = 0;
+    if (HAL_TIM_IC_ConfigChannel(timer.getTimerParameters(), &capture, TIM_CHANNEL_4) != HAL_OK)
+    {
+        return false;
+    }
+    TIM_CCxChannelCmd(timer.getTimerParameters()->Instance, TIM_CHANNEL_4, TIM_CCx_ENABLE);
+    timer.enableCompareIt(TIM_CHANNEL_4);
+    capturePriority = prio.first;
+    HAL_NVIC_SetPriority(TIM2_IRQn, prio.first, prio.second);
+    HAL_NVIC_EnableIRQ(TIM2_IRQn);
+    return true;
+}
+
+bool AnalogFrontEnd::processCaptureIrq ()
+{
+    if (!timer.processCompareIt(TIM_CHANNEL_4))
+    {
+        return false;
+    }
+    edgeTime = timer.getCompare(TIM_CHANNEL_4);
+    level = HAL_COMP_GetOutputLevel(&comp) == COMP_OUTPUTLEVEL_HIGH;
+    setDac(level);
+    return true;
+}
+
+void AnalogFrontEnd::processLevels (uint32_t low, uint32_t high)
+{
+    lowLevel = low;
+    highLevel = high;
+
+    // A window without a frame only contains the idle level: keep the threshold
+    if (automatic && highLevel - lowLevel >= MIN_SWING)
+    {
+        InterruptLock lock(capturePriority);
+        threshold = (3 * threshold + (lowLevel + highLevel) / 2) / 4;
+        hysteresis = (highLevel - lowLevel) / 8;
+        setDac(level);
+    }
+}
+
+void AnalogFrontEnd::setThreshold (uint32_t _threshold, uint32_t _hysteresis)
+{
+    InterruptLock lock(capturePriority);
+    automatic = _threshold == 0;
+    threshold = automatic ? DEFAULT_THRESHOLD : _threshold;
+    hysteresis = automatic ? DEFAULT_HYSTERESIS : _hysteresis;
+    setDac(level);
+}
+
+void AnalogFrontEnd::setDac (bool lineLevel)
+{
+    // After a rising edge, the line shall fall below the lower threshold for the next edge, and vice versa
+    uint32_t value = threshold + hysteresis / 2;
+    if (lineLevel)
+    {
+        value = threshold > hysteresis / 2 ? threshold - hysteresis / 2 : 0;
+    }
+    value = value > 4095 ? 4095 : value;
+    HAL_DAC_SetValue(&dac, DAC_CHANNEL_1, DAC_ALIGN_12B_R, value);
+}
+
+#endif
@@ -0,0 +1,129 @@
+/*
+ * onkyoUsbRi: Onkyo RI control
+ *
+ * Copyright (C) 2021. Mikhail Kulesh
+ *
+ * This program is free software: you can redistribute it and/or modify it under the terms of the GNU
+ * General Public License as published by the Free Software Foundation, either version 3 of the License,
+ * or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without
+ * even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details. You should have received a copy of the GNU General
+ * Public License along with this program.
+ */
+
+#ifndef ANALOG_FRONT_END_H_
+#define ANALOG_FRONT_END_H_
+
+#include "BasicIO.h"
+
+#ifdef RI_ANALOG_INPUT
+
+namespace StmPlusPlus
+{
+
+/**
+ * @brief Comparator input of an RI line with a programmable threshold.
+ *
+ * The line is connected to the non-inverting input of COMP2 (PA7), the threshold is set by the
+ * internal channel DAC2_CH1. The comparator output is routed to the input capture 4 of the RX
+ * timer (TIM2), so the edge time is latched by the hardware independently of the interrupt latency.
+ *
+ * The comparator of the STM32F303x8 has no hysteresis: after each edge, the threshold is moved by
+ * the hysteresis away from the new level. The lowest and the highest line level measured by the
+ * line monitor in each window move the threshold to their middle, so slow edges and ground offsets
+ * of long chains are compensated.
+ */
+class AnalogFrontEnd
+{
+public:
+
+    // DAC and ADC use 12 bits in 3.3 V
+    static const uint32_t DEFAULT_THRESHOLD = 1740; // 1.4 V
+    static const uint32_t DEFAULT_HYSTERESIS = 124; // 100 mV
+    static const uint32_t MIN_SWING = 620; // 0.5 V: smaller level differences do not move the threshold
+
+    AnalogFrontEnd (TimerBase & _timer);
+
+    /**
+     * @brief Start the comparator and the capture interrupt of the timer with the given priority.
+     */
+    bool start (const InterruptPriority & prio);
+
+    /**
+     * @brief Check and clear the capture interrupt and update the threshold to the new level.
+     *
+     * @return true if an edge was captured: getEdgeTime() and getLevel() describe it.
+     */
+    bool processCaptureIrq ();
+
+    /**
+     * @brief Adjust the threshold to the lowest and the highest line level (DAC units) of a window.
+     */
+    void processLevels (uint32_t low, uint32_t high);
+
+    /**
+     * @brief Set the threshold and the hysteresis in DAC units and disable the automatic adjustment,
+     * or enable it again if the threshold is zero.
+     */
+    void setThreshold (uint32_t _threshold, uint32_t _hysteresis);
+
+    inline uint32_t getEdgeTime () const
+    {
+        return edgeTime;
+    }
+
+    inline bool getLevel () const
+    {
+        return level;
+    }
+
+    inline uint32_t getThreshold () const
+    {
+        return threshold;
+    }
+
+    inline uint32_t getHysteresis () const
+    {
+        return hysteresis;
+    }
+
+    inline uint32_t getLowLevel () const
+    {
+        return lowLevel;
+    }
+
+    inline uint32_t getHighLevel () const
+    {
+        return highLevel;
+    }
+
+    inline bool isAutomatic () const
+    {
+        return automatic;
+    }
+
+private:
+
+    TimerBase & timer;
+    IOPin input;
+    COMP_HandleTypeDef comp;
+    DAC_HandleTypeDef dac;
+
+    // The threshold is changed with the capture interrupt masked
+    uint32_t capturePriority;
+    volatile uint32_t threshold, hysteresis;
+    volatile uint32_t edgeTime;
+    volatile bool level;
+    bool automatic;
+
+    // Line levels of the last window
+    uint32_t lowLevel, highLevel;
+
+    void setDac (bool lineLevel);
+};
+
+} // end namespace
+#endif
+#endif
@@ -21,63 +21,42 @@
 using namespace StmPlusPlus;
 
 #define USART_DEBUG_MODULE "COMM: "
+#define USART_DEBUG_MODULE_ID 0
 
 /************************************************************************
  * Class System
  ************************************************************************/
 
+// RAM layout defined in the linker script
+extern "C" uint32_t _sdata, _edata, _sbss, _ebss, _end, _estack;
+
+static const uint32_t STACK_PATTERN = 0xA5A5A5A5;
+
 uint32_t System::externalOscillatorFreq = 16000000;
 uint32_t System::mcuFreq = 16000000;
+System::ClockSource System::clockSource = System::ClockSource::HSI;
 
-void System::setClock (uint32_t pllDiv, uint32_t pllMUL, uint32_t FLatency, RtcType rtcType, int32_t msAdjustment)
+System::ClockSource System::setClock (uint32_t pllDiv, uint32_t pllMUL, uint32_t hsiPllMUL, uint32_t FLatency,
+                                      RtcType rtcType, int32_t msAdjustment)
 {
     RCC_OscInitTypeDef RCC_OscInitStruct;
     RCC_ClkInitTypeDef RCC_ClkInitStruct;
+    RCC_PeriphCLKInitTypeDef PeriphClkInit;
+    ::memset(&RCC_OscInitStruct, 0, sizeof(RCC_OscInitStruct));
+    ::memset(&PeriphClkInit, 0, sizeof(PeriphClkInit));
 
-    #ifdef STM32F3
+    // HSI stays on: it is the current system clock and the fallback
     RCC_OscInitStruct.OscillatorType = RCC_OSCILLATORTYPE_HSE;
     RCC_OscInitStruct.HSEState = RCC_HSE_ON;
     RCC_OscInitStruct.HSEPredivValue = pllDiv;
-    RCC_OscInitStruct.HSIState = RCC_HSI_OFF;
+    RCC_OscInitStruct.HSIState = RCC_HSI_ON;
+    RCC_OscInitStruct.HSICalibrationValue = RCC_HSICALIBRATION_DEFAULT;
     RCC_OscInitStruct.LSEState = RCC_LSE_OFF;
     RCC_OscInitStruct.LSIState = RCC_LSI_OFF;
     RCC_OscInitStruct.PLL.PLLState = RCC_PLL_ON;
     RCC_OscInitStruct.PLL.PLLSource = RCC_PLLSOURCE_HSE;
     RCC_OscInitStruct.PLL.PLLMUL = pllMUL;
-    RCC_ClkInitStruct.ClockType = RCC_CLOCKTYPE_HCLK | RCC_CLOCKTYPE_SYSCLK | RCC_CLOCKTYPE_PCLK1 | RCC_CLOCKTYPE_PCLK2;
-    RCC_ClkInitStruct.SYSCLKSource = RCC_SYSCLKSOURCE_PLLCLK;
-    RCC_ClkInitStruct.AHBCLKDivider = RCC_SYSCLK_DIV1;
-    RCC_ClkInitStruct.APB1CLKDivider = RCC_HCLK_DIV2;
-    RCC_ClkInitStruct.APB2CLKDivider = RCC_HCLK_DIV1;
-    #endif
-
-    #ifdef STM32F4
-    __HAL_RCC_GPIOC_CLK_ENABLE();
-    __HAL_RCC_GPIOH_CLK_ENABLE();
-    __HAL_RCC_PWR_CLK_ENABLE();
-    __HAL_PWR_VOLTAGESCALING_CONFIG(PWR_REGULATOR_VOLTAGE_SCALE1);
-    RCC_OscInitStruct.OscillatorType = RCC_OSCILLATORTYPE_HSE;
-    RCC_OscInitStruct.HSEState = RCC_HSE_ON;
-    RCC_OscInitStruct.HSIState = RCC_HSI_OFF;
-    RCC_OscInitStruct.LSEState = RCC_LSE_OFF;
-    RCC_OscInitStruct.LSIState = RCC_LSI_OFF;
-    RCC_OscInitStruct.PLL.PLLState = RCC_PLL_ON;
-    RCC_OscInitStruct.PLL.PLLSource = RCC_PLLSOURCE_HSE;
-    RCC_OscInitStruct.PLL.PLLM = pllDiv;
-    RCC_OscInitStruct.PLL.PLLN = pllMUL;
-    RCC_OscInitStruct.PLL.PLLP = RCC_PLLP_DIV2;
-    RCC_OscInitStruct.PLL.PLLQ = 8;
-    #ifdef STM32F410Rx
-    RCC_OscInitStruct.PLL.PLLR = 2;
-    #endif
-    RCC_ClkInitStruct.ClockType = RCC_CLOCKTYPE_HCLK | RCC_CLOCKTYPE_SYSCLK | RCC_CLOCKTYPE_PCLK1 | RCC_CLOCKTYPE_PCLK2;
-    RCC_ClkInitStruct.SYSCLKSource = RCC_SYSCLKSOURCE_PLLCLK;
-    RCC_ClkInitStruct.AHBCLKDivider = RCC_SYSCLK_DIV1;
-    RCC_ClkInitStruct.APB1CLKDivider = RCC_HCLK_DIV4;
-    RCC_ClkInitStruct.APB2CLKDivider = RCC_HCLK_DIV2;
-    #endif
 
-    RCC_PeriphCLKInitTypeDef PeriphClkInit;
     switch (rtcType)
     {
     case RtcType::RTC_INT:
@@ -97,19 +76,31 @@ void System::setClock (uint32_t pllDiv, uint32_t pllMUL, uint32_t FLatency, RtcT
         break;
     }
 
-    HAL_RCC_OscConfig(&RCC_OscInitStruct);
+    // The HAL waits for the HSE at most HSE_STARTUP_TIMEOUT
+    clockSource = ClockSource::HSE;
+    if (HAL_RCC_OscConfig(&RCC_OscInitStruct) != HAL_OK)
+    {
+        // No crystal: the PLL is fed by HSI/2
+        clockSource = ClockSource::HSI;
+        RCC_OscInitStruct.HSEState = RCC_HSE_OFF;
+        RCC_OscInitStruct.PLL.PLLSource = RCC_PLLSOURCE_HSI;
+        RCC_OscInitStruct.PLL.PLLMUL = hsiPllMUL;
+        HAL_RCC_OscConfig(&RCC_OscInitStruct);
+    }
+
+    RCC_ClkInitStruct.ClockType = RCC_CLOCKTYPE_HCLK | RCC_CLOCKTYPE_SYSCLK | RCC_CLOCKTYPE_PCLK1 | RCC_CLOCKTYPE_PCLK2;
+    RCC_ClkInitStruct.SYSCLKSource = RCC_SYSCLKSOURCE_PLLCLK;
+    RCC_ClkInitStruct.AHBCLKDivider = RCC_SYSCLK_DIV1;
+    RCC_ClkInitStruct.APB1CLKDivider = RCC_HCLK_DIV2;
+    RCC_ClkInitStruct.APB2CLKDivider = RCC_HCLK_DIV1;
     HAL_RCC_ClockConfig(&RCC_ClkInitStruct, FLatency);
 
-    /* STM32F405x/407x/415x/417x Revision Z devices: prefetch is supported  */
-    if (HAL_GetREVID() == 0x1001)
+    if (rtcType != RtcType::RTC_NONE)
     {
-    /* Enable the Flash prefetch */
-    __HAL_FLASH_PREFETCH_BUFFER_ENABLE();
+        HAL_RCCEx_PeriphCLKConfig(&PeriphClkInit);
     }
 
-    HAL_RCCEx_PeriphCLKConfig(&PeriphClkInit);
-
-    externalOscillatorFreq = HSE_VALUE;
+    externalOscillatorFreq = clockSource == ClockSource::HSE ? HSE_VALUE : 0;
     mcuFreq = HAL_RCC_GetHCLKFreq();
 
     HAL_SYSTICK_Config(mcuFreq/1000 + msAdjustment);
@@ -117,6 +108,56 @@ void System::setClock (uint32_t pllDiv, uint32_t pllMUL, uint32_t FLatency, RtcT
 
     /* SysTick_IRQn interrupt configuration */
     HAL_NVIC_SetPriority(SysTick_IRQn, 0, 0);
+    return clockSource;
+}
+
+void System::paintStack ()
+{
+    // Keep a margin for the frame of this function
+    uint32_t * top = (uint32_t *) (__get_MSP() - 64);
+    for (uint32_t * p = &_end; p < top; p++)
+    {
+        *p = STACK_PATTERN;
+    }
+}
+
+size_t System::getStackPeak ()
+{
+    const uint32_t * p = &_end;
+    while (p < &_estack && *p == STACK_PATTERN)
+    {
+        p++;
+    }
+    return (&_estack - p) * sizeof(uint32_t);
+}
+
+size_t System::getStackSize ()
+{
+    return (&_estack - &_end) * sizeof(uint32_t);
+}
+
+size_t System::getDataSize ()
+{
+    return (&_edata - &_sdata) * sizeof(uint32_t);
+}
+
+size_t System::getBssSize ()
+{
+    return (&_ebss - &_sbss) * sizeof(uint32_t);
+}
+
+/************************************************************************
+ * Class InterruptLock
+ ************************************************************************/
+
+volatile uint32_t InterruptLock::maxCycles = 0;
+
+void InterruptLock::startMeasurement ()
+{
+    CoreDebug->DEMCR |= CoreDebug_DEMCR_TRCENA_Msk;
+    DWT->CYCCNT = 0;
+    DWT->CTRL |= DWT_CTRL_CYCCNTENA_Msk;
+    maxCycles = 0;
 }
 
 /************************************************************************
@@ -265,6 +306,14 @@ void Usart::disableClock ()
     }
 }
 
+void Usart::setFlowControl (uint32_t hwFlowCtl, PortName name, uint32_t pins)
+{
+    // The flow control pins use the same alternate function as TX and RX
+    IOPort flowPins(name, GPIO_MODE_AF_PP, GPIO_PULLUP, gpioParameters.Speed, pins, false);
+    flowPins.setAlternate(gpioParameters.Alternate);
+    usartParameters.Init.HwFlowCtl = hwFlowCtl;
+}
+
 HAL_StatusTypeDef Usart::start (uint32_t mode, uint32_t baudRate, uint32_t wordLength/* = UART_WORDLENGTH_8B*/,
                                 uint32_t stopBits/* = UART_STOPBITS_1*/, uint32_t parity/* = UART_PARITY_NONE*/)
 {
@@ -316,31 +365,119 @@ HAL_StatusTypeDef Usart::receiveIt (const char * buffer, size_t n)
  ************************************************************************/
 
 UsartLogger * UsartLogger::instance = NULL;
+uint8_t UsartLogger::levels[UsartLogger::MAX_MODULES] = { LOG_LEVEL_TRACE };
 
 UsartLogger::UsartLogger (DeviceName device, PortName name, uint32_t txPin, uint32_t rxPin, uint32_t speed, uint32_t _baudRate) :
         Usart(device, name, txPin, rxPin, speed),
         baudRate(_baudRate),
-        radix(10)
+        radix(10),
+        width(0),
+        fill(' ')
 {
     // empty
 }
 
+bool UsartLogger::setLevel (uint8_t module, uint8_t level)
+{
+    if ((module >= MAX_MODULES && module != ALL_MODULES) || level > LOG_LEVEL_ERROR + 1)
+    {
+        return false;
+    }
+    for (size_t i = 0; i < MAX_MODULES; i++)
+    {
+        if (module == ALL_MODULES || module == i)
+        {
+            levels[i] = level;
+        }
+    }
+    return true;
+}
+
 UsartLogger & UsartLogger::operator << (const char * buffer)
 {
     transmit(buffer);
     return *this;
 }
 
-UsartLogger & UsartLogger::operator << (int n)
+UsartLogger & UsartLogger::putNumber (uint64_t n, bool negative)
+{
+    // A single transmit of the whole number, including the prefix and the padding
+    char buffer[NumberFormat::BUFFER_SIZE];
+    transmit(NumberFormat::format(buffer, n, negative, radix, width, fill));
+
+    // The width is only applied to a single number
+    width = 0;
+    fill = ' ';
+    return *this;
+}
+
+void UsartLogger::putLog (const char * format, const uint32_t * args, size_t argc)
 {
-    char buffer[1024];
-    if (radix == 16)
+#ifdef USART_LOG_TOKENIZED
+    // Record: start byte, then LEB128 numbers: format ID, time stamp in ms, arguments count and arguments
+    uint8_t record[2 + 5 * (MAX_LOG_ARGS + 2)];
+    size_t length = 0;
+    record[length++] = LOG_RECORD_START;
+    uint32_t values[MAX_LOG_ARGS + 3] = { uint32_t(format), HAL_GetTick(), argc };
+    ::memcpy(values + 3, args, argc * sizeof(uint32_t));
+    for (size_t i = 0; i < argc + 3; i++)
     {
-        transmit("0x");
+        uint32_t v = values[i];
+        while (v > 0x7F)
+        {
+            record[length++] = 0x80 | (v & 0x7F);
+            v >>= 7;
+        }
+        record[length++] = v;
     }
-    ::__itoa(n, buffer, radix);
-    transmit(buffer);
-    return *this;
+    transmit((const char *) record, length, 0xFFFF);
+#else
+    const uint32_t savedRadix = radix;
+    const char * chunk = format;
+    const char * p = format;
+    while (*p != 0)
+    {
+        if (*p != '%' && *p != '\n')
+        {
+            p++;
+            continue;
+        }
+        if (p > chunk)
+        {
+            transmit(chunk, p - chunk, 0xFFFF);
+        }
+        if (*p == '\n')
+        {
+            operator << (ENDL);
+        }
+        else if (p[1] == '%')
+        {
+            transmit("%");
+            p++;
+        }
+        else if (p[1] == 'd' || p[1] == 'u' || p[1] == 'x')
+        {
+            const uint32_t v = argc > 0 ? *args++ : 0;
+            argc = argc > 0 ? argc - 1 : 0;
+            radix = p[1] == 'x' ? 16 : 10;
+            if (p[1] == 'd')
+            {
+                operator << (int(v));
+            }
+            else
+            {
+                operator << ((unsigned int) v);
+            }
+            p++;
+        }
+        chunk = ++p;
+    }
+    if (p > chunk)
+    {
+        transmit(chunk, p - chunk, 0xFFFF);
+    }
+    radix = savedRadix;
+#endif
 }
 
 UsartLogger & UsartLogger::operator << (Manupulator m)
@@ -527,11 +664,19 @@ AnalogToDigitConverter::AnalogToDigitConverter (PortName name, uint32_t pin, Dev
         #ifdef ADC1
         adcParams.Instance = ADC1;
         #endif
+        #ifdef STM32F3
+        dmaParams.Instance = DMA1_Channel1;
+        dmaIrq = DMA1_Channel1_IRQn;
+        #endif
         break;
     case ADC_2:
         #ifdef ADC2
         adcParams.Instance = ADC2;
         #endif
+        #ifdef STM32F3
+        dmaParams.Instance = DMA1_Channel2;
+        dmaIrq = DMA1_Channel2_IRQn;
+        #endif
         break;
     case ADC_3:
         #ifdef ADC3
@@ -558,6 +703,28 @@ AnalogToDigitConverter::AnalogToDigitConverter (PortName name, uint32_t pin, Dev
     adcChannel.Rank = 1;
     adcChannel.SamplingTime = ADC_SAMPLETIME_56CYCLES;
     adcChannel.Offset = 0;
+    #elif defined(STM32F3)
+    adcParams.Init.ClockPrescaler = ADC_CLOCK_SYNC_PCLK_DIV2;
+    adcParams.Init.Resolution = ADC_RESOLUTION_12B;
+    adcParams.Init.DataAlign = ADC_DATAALIGN_RIGHT;
+    adcParams.Init.ScanConvMode = ADC_SCAN_DISABLE;
+    adcParams.Init.EOCSelection = ADC_EOC_SINGLE_CONV;
+    adcParams.Init.LowPowerAutoWait = DISABLE;
+    adcParams.Init.ContinuousConvMode = DISABLE;
+    adcParams.Init.NbrOfConversion = 1;
+    adcParams.Init.DiscontinuousConvMode = DISABLE;
+    adcParams.Init.NbrOfDiscConversion = 0;
+    adcParams.Init.ExternalTrigConv = ADC_SOFTWARE_START;
+    adcParams.Init.ExternalTrigConvEdge = ADC_EXTERNALTRIGCONVEDGE_NONE;
+    adcParams.Init.DMAContinuousRequests = DISABLE;
+    adcParams.Init.Overrun = ADC_OVR_DATA_OVERWRITTEN;
+
+    adcChannel.Channel = channel;
+    adcChannel.Rank = ADC_REGULAR_RANK_1;
+    adcChannel.SamplingTime = ADC_SAMPLETIME_19CYCLES_5;
+    adcChannel.SingleDiff = ADC_SINGLE_ENDED;
+    adcChannel.OffsetNumber = ADC_OFFSET_NONE;
+    adcChannel.Offset = 0;
     #endif
     HAL_ADC_DeInit(&adcParams);
     disableClock();
@@ -625,6 +792,14 @@ HAL_StatusTypeDef AnalogToDigitConverter::start ()
         return halStatus;
     }
 
+    #ifdef STM32F3
+    halStatus = HAL_ADCEx_Calibration_Start(hadc, ADC_SINGLE_ENDED);
+    if (halStatus != HAL_OK)
+    {
+        return halStatus;
+    }
+    #endif
+
     halStatus = HAL_ADC_ConfigChannel(hadc, &adcChannel);
     if (halStatus != HAL_OK)
     {
@@ -660,6 +835,53 @@ float AnalogToDigitConverter::getVoltage ()
     return (vRef * (float) getValue()) / 4095.0;
 }
 
+#ifdef STM32F3
+HAL_StatusTypeDef AnalogToDigitConverter::startContinuous (uint32_t trigger, const uint32_t * channels, size_t count,
+                                                           uint16_t * buffer, size_t length)
+{
+    __HAL_RCC_DMA1_CLK_ENABLE();
+    dmaParams.Init.Direction = DMA_PERIPH_TO_MEMORY;
+    dmaParams.Init.PeriphInc = DMA_PINC_DISABLE;
+    dmaParams.Init.MemInc = DMA_MINC_ENABLE;
+    dmaParams.Init.PeriphDataAlignment = DMA_PDATAALIGN_HALFWORD;
+    dmaParams.Init.MemDataAlignment = DMA_MDATAALIGN_HALFWORD;
+    dmaParams.Init.Mode = DMA_CIRCULAR;
+    dmaParams.Init.Priority = DMA_PRIORITY_MEDIUM;
+    HAL_StatusTypeDef halStatus = HAL_DMA_Init(&dmaParams);
+    if (halStatus != HAL_OK)
+    {
+        return halStatus;
+    }
+    __HAL_LINKDMA(&adcParams, DMA_Handle, dmaParams);
+
+    adcParams.Init.ScanConvMode = count > 1 ? ADC_SCAN_ENABLE : ADC_SCAN_DISABLE;
+    adcParams.Init.EOCSelection = ADC_EOC_SEQ_CONV;
+    adcParams.Init.NbrOfConversion = count;
+    adcParams.Init.ExternalTrigConv = trigger;
+    adcParams.Init.ExternalTrigConvEdge = ADC_EXTERNALTRIGCONVEDGE_RISING;
+    adcParams.Init.DMAContinuousRequests = ENABLE;
+    halStatus = start();
+    if (halStatus != HAL_OK)
+    {
+        return halStatus;
+    }
+
+    // Long sampling time: the internal reference needs at least 2.2 us
+    for (size_t i = 0; i < count; i++)
+    {
+        adcChannel.Channel = channels[i];
+        adcChannel.Rank = ADC_REGULAR_RANK_1 + i;
+        adcChannel.SamplingTime = ADC_SAMPLETIME_181CYCLES_5;
+        halStatus = HAL_ADC_ConfigChannel(&adcParams, &adcChannel);
+        if (halStatus != HAL_OK)
+        {
+            return halStatus;
+        }
+    }
+    return HAL_ADC_Start_DMA(&adcParams, (uint32_t *) buffer, length);
+}
+#endif
+
 /************************************************************************
  * Class TimerBase
  ************************************************************************/
@@ -773,6 +995,14 @@ HAL_StatusTypeDef TimerBase::startCounter (uint32_t counterMode, uint32_t presca
     return HAL_TIM_Base_Start(&timerParameters);
 }
 
+HAL_StatusTypeDef TimerBase::setTriggerOutput (uint32_t trigger)
+{
+    TIM_MasterConfigTypeDef masterConfig = {};
+    masterConfig.MasterOutputTrigger = trigger;
+    masterConfig.MasterSlaveMode = TIM_MASTERSLAVEMODE_DISABLE;
+    return HAL_TIMEx_MasterConfigSynchronization(&timerParameters, &masterConfig);
+}
+
 HAL_StatusTypeDef TimerBase::stopCounter ()
 {
     HAL_TIM_Base_Stop(&timerParameters);
@@ -842,3 +1072,31 @@ void PulseWidthModulation::stop ()
     pin.setMode(GPIO_MODE_OUTPUT_PP);
     pin.setLow();
 }
+
+/************************************************************************
+ * Class IndependentWatchdog
+ ************************************************************************/
+IndependentWatchdog::IndependentWatchdog ()
+{
+    ::memset(&iwdgParameters, 0, sizeof(iwdgParameters));
+    iwdgParameters.Instance = IWDG;
+}
+
+HAL_StatusTypeDef IndependentWatchdog::start (uint32_t timeoutMs)
+{
+    // Prescaler 32: a counter tick is 0.8 ms at the nominal LSI frequency, the maximum timeout is about 3.3 s
+    uint32_t reload = (timeoutMs * (LSI_VALUE / 32)) / 1000;
+    iwdgParameters.Init.Prescaler = IWDG_PRESCALER_32;
+    iwdgParameters.Init.Reload = reload > 0xFFF ? 0xFFF : reload;
+    iwdgParameters.Init.Window = IWDG_WINDOW_DISABLE;
+
+    // Keep the watchdog stopped while the core is halted by the debugger
+    __HAL_DBGMCU_FREEZE_IWDG();
+
+    HAL_StatusTypeDef status = HAL_IWDG_Init(&iwdgParameters);
+    if (status != HAL_OK)
+    {
+        return status;
+    }
+    return HAL_IWDG_Start(&iwdgParameters);
+}
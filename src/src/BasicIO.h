@@ -37,6 +37,7 @@
 #include <cstring>
 #include <cstdlib>
 #include <functional>
+#include "NumberFormat.h"
 
 
 /**
@@ -80,6 +81,12 @@ namespace StmPlusPlus
             RTC_EXT = 2
         };
 
+        enum class ClockSource
+        {
+            HSE = 0,
+            HSI = 1
+        };
+
         static uint32_t getExternalOscillatorFreq ()
         {
             return externalOscillatorFreq;
@@ -90,7 +97,98 @@ namespace StmPlusPlus
             return mcuFreq;
         }
 
-        static void setClock (uint32_t pllDiv, uint32_t pllMUL, uint32_t FLatency, RtcType rtcType, int32_t msAdjustment = 0);
+        static ClockSource getClockSource ()
+        {
+            return clockSource;
+        }
+
+        /**
+         * @brief Run the system clock from the PLL fed by HSE with the given divider and multiplier.
+         *
+         * If HSE does not start within HSE_STARTUP_TIMEOUT, the PLL is fed by HSI/2 with the
+         * multiplier hsiPllMUL instead.
+         */
+        static ClockSource setClock (uint32_t pllDiv, uint32_t pllMUL, uint32_t hsiPllMUL, uint32_t FLatency,
+                                     RtcType rtcType, int32_t msAdjustment = 0);
+
+        /**
+         * @brief Fill the free RAM between the static data and the current stack pointer with a pattern.
+         *
+         * Shall be called at the very beginning of main(). Afterwards, getStackPeak() finds the deepest
+         * stack usage as the lowest overwritten word.
+         */
+        static void paintStack ();
+
+        static size_t getStackPeak ();
+
+        static size_t getStackSize ();
+
+        static size_t getDataSize ();
+
+        static size_t getBssSize ();
+
+    private:
+
+        static ClockSource clockSource;
+    };
+
+    /**
+     * @brief Critical section for the lifetime of the object: masks the interrupts with the given
+     * preemption priority and all lower ones.
+     *
+     * The mask is set by BASEPRI, so the interrupts with a higher priority are still served; the
+     * priority 0 masks all interrupts by PRIMASK. BASEPRI compares the whole priority byte, so the
+     * priority grouping shall be NVIC_PRIORITYGROUP_4 (no sub-priority) as set by HAL_Init().
+     * Locks can be nested: the mask is only raised, and restored when the lock ends.
+     *
+     * After startMeasurement(), the longest masked time is measured with the DWT cycle counter.
+     */
+    class InterruptLock
+    {
+    public:
+
+        explicit InterruptLock (uint32_t priority) :
+            primask { __get_PRIMASK() },
+            basepri { __get_BASEPRI() }
+        {
+            if (priority == 0)
+            {
+                __disable_irq();
+            }
+            else
+            {
+                __set_BASEPRI_MAX(priority << (8 - __NVIC_PRIO_BITS));
+            }
+            start = DWT->CYCCNT;
+        }
+
+        ~InterruptLock ()
+        {
+            const uint32_t cycles = DWT->CYCCNT - start;
+            maxCycles = cycles > maxCycles ? cycles : maxCycles;
+            __set_BASEPRI(basepri);
+            __set_PRIMASK(primask);
+        }
+
+        static void startMeasurement ();
+
+        /**
+         * @brief Longest masked time in CPU cycles since the start or the reset of the measurement.
+         */
+        static inline uint32_t getMaxCycles ()
+        {
+            return maxCycles;
+        }
+
+        static inline void resetMaxCycles ()
+        {
+            maxCycles = 0;
+        }
+
+    private:
+
+        uint32_t primask, basepri, start;
+        static volatile uint32_t maxCycles;
     };
     
     /**
@@ -212,6 +310,14 @@ namespace StmPlusPlus
         {
             return port->IDR;
         }
+
+        /**
+         * @brief Returns the address of the input data register, for example as the source of a DMA transfer.
+         */
+        inline const volatile uint32_t * getInputRegister () const
+        {
+            return &port->IDR;
+        }
         
     protected:
         
@@ -291,6 +397,14 @@ namespace StmPlusPlus
         void enableClock ();
         void disableClock ();
 
+        /**
+         * @brief Use hardware flow control (UART_HWCONTROL_RTS, _CTS or _RTS_CTS) on the given pins.
+         *
+         * Shall be called before start(). With RTS, the USART deasserts the line as long as a received
+         * byte is not read, i.e. the sender is stopped while no reception is active.
+         */
+        void setFlowControl (uint32_t hwFlowCtl, PortName name, uint32_t pins);
+
         /**
          * @brief Open transmission session with given mode.
          */
@@ -358,6 +472,15 @@ namespace StmPlusPlus
             return irqStatus == SET;
         }
         
+        /**
+         * @brief Check whether a transmission in interrupt mode is ongoing.
+         */
+        inline bool isTxBusy () const
+        {
+            return usartParameters.State == HAL_UART_STATE_BUSY_TX
+                   || usartParameters.State == HAL_UART_STATE_BUSY_TX_RX;
+        }
+        
     private:
         
         DeviceName device;
@@ -366,13 +489,77 @@ namespace StmPlusPlus
         __IO ITStatus irqStatus;
     };
     
+    /**
+     * @brief Log levels. Messages below the build-time threshold USART_LOG_LEVEL are removed by the
+     * compiler; above it, each module (USART_DEBUG_MODULE_ID of the source file) can be filtered at runtime.
+     */
+    #define LOG_LEVEL_TRACE 0
+    #define LOG_LEVEL_DEBUG 1
+    #define LOG_LEVEL_INFO 2
+    #define LOG_LEVEL_WARN 3
+    #define LOG_LEVEL_ERROR 4
+
+    #ifndef USART_LOG_LEVEL
+    #define USART_LOG_LEVEL LOG_LEVEL_TRACE
+    #endif
+
     #define IS_USART_DEBUG_ACTIVE() (UsartLogger::getInstance() != NULL)
+
+    #define USART_LOG_ENABLED(level) \
+        ((level) >= USART_LOG_LEVEL && UsartLogger::isEnabled(USART_DEBUG_MODULE_ID, (level)))
     
-    #define USART_DEBUG(text) {\
+    #define USART_STREAM(level, text) {\
+    if (USART_LOG_ENABLED(level))\
+    {\
+        UsartLogger::getStream() << USART_DEBUG_MODULE << text;\
+    }}
+
+    #define USART_DEBUG(text) USART_STREAM(LOG_LEVEL_DEBUG, text)
+
+    /**
+     * @brief Reports requested by the host (and the startup report) in the stream form: they are not
+     * filtered by the build-time and runtime log levels, only suppressed while the logger is inactive.
+     */
+    #define USART_REPORT(text) {\
     if (IS_USART_DEBUG_ACTIVE())\
     {\
         UsartLogger::getStream() << USART_DEBUG_MODULE << text;\
     }}
+
+    #ifdef USART_LOG_TOKENIZED
+    // Format strings are kept in a section that is not loaded into the flash: the address of a string is its ID
+    #define USART_LOG_SECTION __attribute__((section(".logstr")))
+    #else
+    #define USART_LOG_SECTION
+    #endif
+
+    /**
+     * @brief Log a message given by a printf-like format: %d, %u, %x (with 0x prefix) and %%.
+     *
+     * In the tokenized mode (USART_LOG_TOKENIZED build setting), only a binary record with the format ID,
+     * the time stamp and the arguments is sent. The text is restored on the host by tools/logdecode.py.
+     */
+    #define USART_LOG(level, format, ...) {\
+    if (USART_LOG_ENABLED(level))\
+    {\
+        static const char usartLogFormat[] USART_LOG_SECTION = USART_DEBUG_MODULE format;\
+        UsartLogger::getStream().log(usartLogFormat, ##__VA_ARGS__);\
+    }}
+
+    /**
+     * @brief Reply to a host command in the form of USART_LOG: not filtered by the log levels.
+     */
+    #define USART_REPLY(format, ...) {\
+    if (IS_USART_DEBUG_ACTIVE())\
+    {\
+        static const char usartLogFormat[] USART_LOG_SECTION = USART_DEBUG_MODULE format;\
+        UsartLogger::getStream().log(usartLogFormat, ##__VA_ARGS__);\
+    }}
+
+    #define USART_TRACE(format, ...) USART_LOG(LOG_LEVEL_TRACE, format, ##__VA_ARGS__)
+    #define USART_INFO(format, ...) USART_LOG(LOG_LEVEL_INFO, format, ##__VA_ARGS__)
+    #define USART_WARN(format, ...) USART_LOG(LOG_LEVEL_WARN, format, ##__VA_ARGS__)
+    #define USART_ERROR(format, ...) USART_LOG(LOG_LEVEL_ERROR, format, ##__VA_ARGS__)
     
     /**
      * @brief Class implementing USART logger.
@@ -403,6 +590,19 @@ namespace StmPlusPlus
         {
             return *instance;
         }
+
+        static const size_t MAX_MODULES = 8;
+        static const uint8_t ALL_MODULES = 0xFF;
+
+        static inline bool isEnabled (uint8_t module, uint8_t level)
+        {
+            return instance != NULL && level >= levels[module];
+        }
+
+        /**
+         * @brief Set the minimal runtime log level of the given module or of all modules.
+         */
+        static bool setLevel (uint8_t module, uint8_t level);
         
         inline void initInstance ()
         {
@@ -416,22 +616,104 @@ namespace StmPlusPlus
             instance = NULL;
         }
         
+        /**
+         * @brief Temporary disable the logging while the USART is used for other data.
+         */
+        inline void suspendInstance ()
+        {
+            instance = NULL;
+        }
+        
+        inline void resumeInstance ()
+        {
+            instance = this;
+        }
+        
         UsartLogger & operator << (const uint8_t * buffer)
         {
             return operator << ((const char * ) buffer);
         }
 
+        /**
+         * @brief Minimal width and fill character of the next printed number.
+         */
+        struct Width
+        {
+            uint8_t width;
+            char fill;
+        };
+
+        static inline Width setWidth (uint8_t width, char fill = ' ')
+        {
+            return Width { width, fill };
+        }
+
         UsartLogger & operator << (const char * buffer);
 
-        UsartLogger & operator << (int n);
+        UsartLogger & operator << (int n)
+        {
+            return putNumber(n < 0 && radix == 10 ? -uint32_t(n) : uint32_t(n), n < 0 && radix == 10);
+        }
+
+        UsartLogger & operator << (unsigned int n)
+        {
+            return putNumber(n, false);
+        }
+
+        UsartLogger & operator << (long n)
+        {
+            return putNumber(n < 0 && radix == 10 ? -(unsigned long)(n) : (unsigned long)(n), n < 0 && radix == 10);
+        }
+
+        UsartLogger & operator << (unsigned long n)
+        {
+            return putNumber(n, false);
+        }
+
+        UsartLogger & operator << (long long n)
+        {
+            return putNumber(n < 0 && radix == 10 ? -uint64_t(n) : uint64_t(n), n < 0 && radix == 10);
+        }
+
+        UsartLogger & operator << (unsigned long long n)
+        {
+            return putNumber(n, false);
+        }
 
         UsartLogger & operator << (Manupulator m);
 
+        UsartLogger & operator << (Width w)
+        {
+            width = w.width;
+            fill = w.fill;
+            return *this;
+        }
+
+        static const size_t MAX_LOG_ARGS = 6;
+        static const char LOG_RECORD_START = 0x1E;
+
+        /**
+         * @brief Print or send as a binary record a message of USART_LOG.
+         */
+        template<typename... Args>
+        inline void log (const char * format, Args... args)
+        {
+            static_assert(sizeof...(Args) <= MAX_LOG_ARGS, "Too many log arguments");
+            const uint32_t values[] = { 0, uint32_t(args)... };
+            putLog(format, values + 1, sizeof...(Args));
+        }
+
     private:
-        
+
         static UsartLogger * instance;
+        static uint8_t levels[MAX_MODULES];
         uint32_t baudRate;
         uint32_t radix;
+        uint8_t width;
+        char fill;
+
+        UsartLogger & putNumber (uint64_t n, bool negative);
+        void putLog (const char * format, const uint32_t * args, size_t argc);
     };
     
     
@@ -515,12 +797,37 @@ namespace StmPlusPlus
         uint32_t getValue ();
         float getVoltage ();
 
+        #ifdef STM32F3
+        /**
+         * @brief Start the conversion of the given channels on each external trigger event (for example
+         * ADC_EXTERNALTRIGCONV_T6_TRGO). The results are written by DMA into the circular buffer without
+         * the CPU; HAL_ADC_ConvHalfCpltCallback and HAL_ADC_ConvCpltCallback are called from
+         * processDmaInterrupt() when a half of the buffer is complete.
+         */
+        HAL_StatusTypeDef startContinuous (uint32_t trigger, const uint32_t * channels, size_t count,
+                                           uint16_t * buffer, size_t length);
+
+        inline void processDmaInterrupt ()
+        {
+            HAL_DMA_IRQHandler(&dmaParams);
+        }
+
+        inline IRQn_Type getDmaIrq () const
+        {
+            return dmaIrq;
+        }
+        #endif
+
     private:
 
         DeviceName device;
         float vRef;
         ADC_HandleTypeDef adcParams;
         ADC_ChannelConfTypeDef adcChannel;
+        #ifdef STM32F3
+        DMA_HandleTypeDef dmaParams;
+        IRQn_Type dmaIrq;
+        #endif
 
         void enableClock();
         void disableClock();
@@ -572,6 +879,12 @@ namespace StmPlusPlus
 
         HAL_StatusTypeDef stopCounter ();
 
+        /**
+         * @brief Select the trigger output (TRGO) of the running timer, for example TIM_TRGO_UPDATE to
+         * start the conversions of an ADC.
+         */
+        HAL_StatusTypeDef setTriggerOutput (uint32_t trigger);
+
         inline uint32_t getValue () const
         {
             return __HAL_TIM_GET_COUNTER(&timerParameters);
@@ -582,8 +895,60 @@ namespace StmPlusPlus
             __HAL_TIM_SET_COUNTER(&timerParameters, 0);
         }
 
+        /**
+         * @brief Set the compare value of the given channel.
+         */
+        inline void setCompare (uint32_t channel, uint32_t value)
+        {
+            __HAL_TIM_SET_COMPARE(&timerParameters, channel, value);
+        }
+
+        inline uint32_t getCompare (uint32_t channel) const
+        {
+            return __HAL_TIM_GET_COMPARE(&timerParameters, channel);
+        }
+
+        /**
+         * @brief Clear the pending flag and enable the compare interrupt of the given channel.
+         */
+        inline void enableCompareIt (uint32_t channel)
+        {
+            __HAL_TIM_CLEAR_IT(&timerParameters, getCompareIt(channel));
+            __HAL_TIM_ENABLE_IT(&timerParameters, getCompareIt(channel));
+        }
+
+        inline void disableCompareIt (uint32_t channel)
+        {
+            __HAL_TIM_DISABLE_IT(&timerParameters, getCompareIt(channel));
+        }
+
+        /**
+         * @brief Check and clear the compare interrupt of the given channel.
+         *
+         * @return true if the interrupt is enabled and was pending.
+         */
+        inline bool processCompareIt (uint32_t channel)
+        {
+            const uint32_t it = getCompareIt(channel);
+            if ((timerParameters.Instance->DIER & it) && (timerParameters.Instance->SR & it))
+            {
+                __HAL_TIM_CLEAR_IT(&timerParameters, it);
+                return true;
+            }
+            return false;
+        }
+
     protected:
 
+        /**
+         * @brief Returns the interrupt (and flag) mask of the given channel: TIM_IT_CC1...TIM_IT_CC4.
+         */
+        static inline uint32_t getCompareIt (uint32_t channel)
+        {
+            return TIM_IT_CC1 << (channel >> 2);
+        }
+
+
         TIM_HandleTypeDef timerParameters;
     };
 
@@ -607,5 +972,28 @@ namespace StmPlusPlus
         TIM_OC_InitTypeDef channelParameters;
     };
 
+    /**
+     * @brief Class that implements the independent watchdog clocked by LSI.
+     *
+     * Once started, the watchdog can not be stopped: refresh() shall be called more often than the timeout.
+     */
+    class IndependentWatchdog
+    {
+    public:
+
+        IndependentWatchdog ();
+
+        HAL_StatusTypeDef start (uint32_t timeoutMs);
+
+        inline void refresh ()
+        {
+            HAL_IWDG_Refresh(&iwdgParameters);
+        }
+
+    private:
+
+        IWDG_HandleTypeDef iwdgParameters;
+    };
+
 } // end namespace
 #endif
@@ -0,0 +1,159 @@
+/*
+ * onkyoUsbRi: Onkyo RI control
+ * 
+ * Copyright (C) 2021. Mikhail Kulesh
+ *
+ * This program is free software: you can redistribute it and/or modify it under the terms of the GNU
+ * General Public License as published by the Free Software Foundation, either version 3 of the License,
+ * or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without
+ * even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details. You should have received a copy of the GNU General
+ * Public License along with this program.
+ */
+
+#include "CrashDump.h"
+
+using namespace StmPlusPlus;
+
+#define USART_DEBUG_MODULE "CRASH: "
+#define USART_DEBUG_MODULE_ID 3
+
+// Top of the stack defined in the linker script
+extern "C" uint32_t _estack;
+
+/************************************************************************
+ * Class CrashDump
+ ************************************************************************/
+
+CrashDump::Record CrashDump::record __attribute__((section(".noinit")));
+
+CrashDump::ResetCause CrashDump::report ()
+{
+    ResetCause cause = ResetCause::PIN;
+    if (__HAL_RCC_GET_FLAG(RCC_FLAG_PORRST))
+    {
+        cause = ResetCause::POWER_ON;
+    }
+    else if (__HAL_RCC_GET_FLAG(RCC_FLAG_IWDGRST))
+    {
+        cause = ResetCause::WATCHDOG;
+    }
+    else if (__HAL_RCC_GET_FLAG(RCC_FLAG_SFTRST))
+    {
+        cause = record.magic == MAGIC ? ResetCause::FAULT : ResetCause::SOFTWARE;
+    }
+    __HAL_RCC_CLEAR_RESET_FLAGS();
+
+    // The RAM content is undefined after power-on
+    if (cause == ResetCause::POWER_ON)
+    {
+        record.resets = 0;
+    }
+
+    switch (cause)
+    {
+    case ResetCause::POWER_ON:
+        USART_STREAM(LOG_LEVEL_WARN, "reset by power-on" << UsartLogger::ENDL);
+        break;
+    case ResetCause::PIN:
+        USART_STREAM(LOG_LEVEL_WARN, "reset by pin" << UsartLogger::ENDL);
+        break;
+    case ResetCause::SOFTWARE:
+        USART_STREAM(LOG_LEVEL_WARN, "reset by software" << UsartLogger::ENDL);
+        break;
+    case ResetCause::WATCHDOG:
+        record.resets++;
+        USART_STREAM(LOG_LEVEL_ERROR, "reset by watchdog, resets " << record.resets << UsartLogger::ENDL);
+        reportEvents();
+        break;
+    case ResetCause::FAULT:
+        USART_STREAM(LOG_LEVEL_ERROR, "hard fault at " << record.uptime << " ms, resets " << record.resets << UsartLogger::ENDL);
+        USART_STREAM(LOG_LEVEL_ERROR, UsartLogger::HEX << "pc=" << record.frame[PC] << " lr=" << record.frame[LR]
+                     << " psr=" << record.frame[PSR] << " sp=" << record.sp << " exc=" << record.excReturn
+                     << UsartLogger::ENDL);
+        USART_STREAM(LOG_LEVEL_ERROR, "r0=" << record.frame[R0] << " r1=" << record.frame[R1] << " r2=" << record.frame[R2]
+                     << " r3=" << record.frame[R3] << " r12=" << record.frame[R12] << UsartLogger::ENDL);
+        USART_STREAM(LOG_LEVEL_ERROR, "cfsr=" << record.cfsr << " hfsr=" << record.hfsr << " mmfar=" << record.mmfar
+                     << " bfar=" << record.bfar << UsartLogger::ENDL);
+        USART_STREAM(LOG_LEVEL_ERROR, "stack:");
+        if (USART_LOG_ENABLED(LOG_LEVEL_ERROR))
+        {
+            for (size_t i = 0; i < STACK_WORDS; i++)
+            {
+                UsartLogger::getStream() << " " << record.stack[i];
+            }
+            UsartLogger::getStream() << UsartLogger::DEC << UsartLogger::ENDL;
+        }
+        reportEvents();
+        break;
+    }
+
+    record.magic = 0;
+    record.eventIndex = 0;
+    ::memset(record.events, 0, sizeof(record.events));
+    return cause;
+}
+
+void CrashDump::reportEvents ()
+{
+    // The oldest event first, the index may be garbage if the RAM was never initialized
+    USART_STREAM(LOG_LEVEL_ERROR, "last events:");
+    if (USART_LOG_ENABLED(LOG_LEVEL_ERROR))
+    {
+        for (size_t i = 0; i < EVENTS_COUNT; i++)
+        {
+            const uint16_t e = record.events[(record.eventIndex + i) & (EVENTS_COUNT - 1)];
+            UsartLogger::getStream() << " " << int(e >> 8) << ":" << int(e & 0xFF);
+        }
+        UsartLogger::getStream() << UsartLogger::ENDL;
+    }
+}
+
+void CrashDump::processFault (const uint32_t * frame, uint32_t excReturn)
+{
+    record.magic = MAGIC;
+    record.resets++;
+    record.uptime = HAL_GetTick();
+    record.sp = uint32_t(frame);
+    record.excReturn = excReturn;
+    record.cfsr = SCB->CFSR;
+    record.hfsr = SCB->HFSR;
+    record.mmfar = SCB->MMFAR;
+    record.bfar = SCB->BFAR;
+
+    // The stack pointer may be corrupted: only read within RAM
+    const uint32_t * top = &_estack;
+    const bool valid = frame >= (const uint32_t *) SRAM_BASE && frame + FRAME_SIZE <= top;
+    for (size_t i = 0; i < FRAME_SIZE; i++)
+    {
+        record.frame[i] = valid ? frame[i] : 0;
+    }
+    for (size_t i = 0; i < STACK_WORDS; i++)
+    {
+        const uint32_t * p = frame + FRAME_SIZE + i;
+        record.stack[i] = valid && p < top ? *p : 0;
+    }
+
+    NVIC_SystemReset();
+}
+
+extern "C" __attribute__((used)) void processHardFault (const uint32_t * frame, uint32_t excReturn)
+{
+    CrashDump::processFault(frame, excReturn);
+}
+
+/**
+ * @brief Pass the stack pointer active at the moment of the fault and EXC_RETURN to the handler.
+ */
+extern "C" __attribute__((naked)) void HardFault_Handler (void)
+{
+    __asm volatile (
+        " tst lr, #4              \n"
+        " ite eq                  \n"
+        " mrseq r0, msp           \n"
+        " mrsne r0, psp           \n"
+        " mov r1, lr              \n"
+        " b processHardFault      \n");
+}
@@ -0,0 +1,97 @@
+/*
+ * onkyoUsbRi: Onkyo RI control
+ * 
+ * Copyright (C) 2021. Mikhail Kulesh
+ *
+ * This program is free software: you can redistribute it and/or modify it under the terms of the GNU
+ * General Public License as published by the Free Software Foundation, either version 3 of the License,
+ * or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without
+ * even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details. You should have received a copy of the GNU General
+ * Public License along with this program.
+ */
+
+#ifndef CRASH_DUMP_H_
+#define CRASH_DUMP_H_
+
+#include "BasicIO.h"
+
+namespace StmPlusPlus
+{
+
+/**
+ * @brief Post-mortem data that survives a reset.
+ *
+ * The record is placed into the .noinit RAM section that is not cleared by the startup code.
+ * The main loop traces the processed events into a small ring. On a hard fault, the handler
+ * adds the stacked registers, the fault status registers and a snapshot of the stack, and resets
+ * the MCU immediately. After the reboot, report() prints the reset cause and the saved data.
+ */
+class CrashDump
+{
+public:
+
+    static const size_t STACK_WORDS = 16;
+    static const size_t EVENTS_COUNT = 16;
+
+    static_assert((EVENTS_COUNT & (EVENTS_COUNT - 1)) == 0, "EVENTS_COUNT shall be a power of two");
+
+    enum class ResetCause
+    {
+        POWER_ON = 0,
+        PIN = 1,
+        SOFTWARE = 2,
+        WATCHDOG = 3,
+        FAULT = 4
+    };
+
+    /**
+     * @brief Determine the reset cause, print the saved data and prepare the record for the new run.
+     *
+     * Shall be called once at startup after the logger is initialized.
+     */
+    static ResetCause report ();
+
+    static inline void putEvent (uint8_t type, uint8_t arg)
+    {
+        record.events[record.eventIndex & (EVENTS_COUNT - 1)] = (uint16_t(type) << 8) | arg;
+        record.eventIndex = record.eventIndex + 1;
+    }
+
+    /**
+     * @brief Save the fault data and reset the MCU: called from the HardFault handler.
+     */
+    static void processFault (const uint32_t * frame, uint32_t excReturn);
+
+private:
+
+    static const uint32_t MAGIC = 0x44554D50; // "DUMP"
+
+    // The exception frame stacked by the core
+    enum Register
+    {
+        R0 = 0, R1, R2, R3, R12, LR, PC, PSR, FRAME_SIZE
+    };
+
+    struct Record
+    {
+        uint32_t magic;
+        uint32_t resets;
+        uint32_t uptime;
+        uint32_t frame[FRAME_SIZE];
+        uint32_t sp, excReturn;
+        uint32_t cfsr, hfsr, mmfar, bfar;
+        uint32_t stack[STACK_WORDS];
+        uint16_t events[EVENTS_COUNT];
+        uint32_t eventIndex;
+    };
+
+    static Record record;
+
+    static void reportEvents ();
+};
+
+} // end namespace
+#endif
@@ -0,0 +1,98 @@
+/*
+ * onkyoUsbRi: Onkyo RI control
+ * 
+ * Copyright (C) 2021. Mikhail Kulesh
+ *
+ * This program is free software: you can redistribute it and/or modify it under the terms of the GNU
+ * General Public License as published by the Free Software Foundation, either version 3 of the License,
+ * or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without
+ * even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details. You should have received a copy of the GNU General
+ * Public License along with this program.
+ */
+
+#include "EdgeCapture.h"
+
+using namespace StmPlusPlus;
+
+/************************************************************************
+ * Class EdgeCapture
+ ************************************************************************/
+
+EdgeCapture::EdgeCapture () :
+    head { 0 },
+    tail { 0 },
+    inFlight { 0 },
+    active { false },
+    portMask { 0 },
+    lastTime { 0 },
+    dropped { false },
+    edges { 0 },
+    droppedEdges { 0 },
+    bytesSent { 0 },
+    highWater { 0 }
+{
+    // empty
+}
+
+void EdgeCapture::start (uint32_t _portMask, uint32_t now)
+{
+    head = tail = inFlight = 0;
+    portMask = _portMask;
+    lastTime = now;
+    dropped = false;
+    edges = droppedEdges = bytesSent = highWater = 0;
+    active = true;
+}
+
+void EdgeCapture::stop ()
+{
+    active = false;
+    // end marker: a redundant zero continuation byte is never produced by the encoder
+    write(0x80);
+    write(0x00);
+}
+
+void EdgeCapture::put (uint8_t port, bool level, uint32_t time)
+{
+    const size_t used = (head + BUFFER_SIZE - tail) % BUFFER_SIZE;
+    // keep space for the end marker
+    if (used + MAX_RECORD_SIZE + 2 >= BUFFER_SIZE)
+    {
+        droppedEdges++;
+        dropped = true;
+        return;
+    }
+    uint32_t delta = time - lastTime;
+    lastTime = time;
+    uint8_t b = (level << 6) | (dropped << 5) | ((port & 0x03) << 3) | (delta & 0x07);
+    delta >>= 3;
+    write(delta != 0 ? (b | 0x80) : b);
+    while (delta != 0)
+    {
+        b = delta & 0x7F;
+        delta >>= 7;
+        write(delta != 0 ? (b | 0x80) : b);
+    }
+    dropped = false;
+    edges++;
+    const size_t fill = (head + BUFFER_SIZE - tail) % BUFFER_SIZE;
+    highWater = fill > highWater ? fill : highWater;
+}
+
+size_t EdgeCapture::getChunk (const char * & data)
+{
+    const size_t h = head;
+    data = (const char *) buffer + tail;
+    inFlight = (h >= tail ? h : BUFFER_SIZE) - tail;
+    return inFlight;
+}
+
+void EdgeCapture::releaseChunk ()
+{
+    bytesSent += inFlight;
+    tail = (tail + inFlight) % BUFFER_SIZE;
+    inFlight = 0;
+}
@@ -0,0 +1,101 @@
+/*
+ * onkyoUsbRi: Onkyo RI control
+ * 
+ * Copyright (C) 2021. Mikhail Kulesh
+ *
+ * This program is free software: you can redistribute it and/or modify it under the terms of the GNU
+ * General Public License as published by the Free Software Foundation, either version 3 of the License,
+ * or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without
+ * even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details. You should have received a copy of the GNU General
+ * Public License along with this program.
+ */
+
+#ifndef EDGE_CAPTURE_H_
+#define EDGE_CAPTURE_H_
+
+#include "BasicIO.h"
+
+namespace StmPlusPlus
+{
+
+/**
+ * @brief Raw edge capture of the RI inputs for protocol analysis.
+ *
+ * Each edge is delta-encoded in the pin interrupt directly into a RAM ring buffer that is
+ * drained to the host by non-blocking USART transmissions. A record consists of a first
+ * byte [C L D P P d d d] followed by LEB128 continuation bytes [C d d d d d d d]:
+ * - C: more bytes follow;
+ * - L: pin level after the edge;
+ * - D: edges were dropped before this one since the buffer was full;
+ * - P: port number;
+ * - d: time since the previous recorded edge in timer ticks of 10 us, least significant
+ *   bits first.
+ * The sequence 0x80 0x00 (never produced by the encoder) marks the end of the capture.
+ */
+class EdgeCapture
+{
+public:
+
+    static const size_t BUFFER_SIZE = 1024;
+    static const size_t MAX_RECORD_SIZE = 6;
+
+    EdgeCapture ();
+    void start (uint32_t _portMask, uint32_t now);
+    void stop ();
+    void put (uint8_t port, bool level, uint32_t time);
+    size_t getChunk (const char * & data);
+    void releaseChunk ();
+
+    inline bool isActive () const
+    {
+        return active;
+    }
+
+    inline bool isPortActive (uint8_t port) const
+    {
+        return active && (portMask & (1 << port));
+    }
+
+    inline uint32_t getEdges () const
+    {
+        return edges;
+    }
+
+    inline uint32_t getDroppedEdges () const
+    {
+        return droppedEdges;
+    }
+
+    inline uint32_t getBytesSent () const
+    {
+        return bytesSent;
+    }
+
+    inline uint32_t getHighWater () const
+    {
+        return highWater;
+    }
+
+private:
+
+    uint8_t buffer[BUFFER_SIZE];
+    volatile size_t head, tail;
+    size_t inFlight;
+    volatile bool active;
+    uint32_t portMask;
+    uint32_t lastTime;
+    bool dropped;
+    uint32_t edges, droppedEdges, bytesSent, highWater;
+
+    inline void write (uint8_t b)
+    {
+        buffer[head] = b;
+        head = (head + 1) % BUFFER_SIZE;
+    }
+};
+
+} // end namespace
+#endif
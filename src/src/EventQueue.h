@@ -28,6 +28,8 @@ private:
     std::array<T, N + 1> buffer;
     size_t head = 0;
     size_t tail = 0;
+    size_t overflows = 0;
+    size_t highWater = 0;
 
 public:
 
@@ -43,7 +45,10 @@ public:
         if(head == tail)
         {
             tail = (tail + 1) % N;
+            overflows++;
         }
+        const size_t s = size();
+        highWater = s > highWater ? s : highWater;
     }
 
     T get (void)
@@ -68,6 +73,30 @@ public:
         return ((head + 1) % N) == tail;
     }
 
+    size_t size () const
+    {
+        return (head + N - tail) % N;
+    }
+
+    /**
+     * @brief Number of the oldest items overwritten since the queue was full.
+     */
+    size_t getOverflows () const
+    {
+        return overflows;
+    }
+
+    size_t getHighWater () const
+    {
+        return highWater;
+    }
+
+    void resetStatistics ()
+    {
+        overflows = 0;
+        highWater = size();
+    }
+
     size_t getHead () const
     {
         return head;
@@ -0,0 +1,205 @@
+/*
+ * onkyoUsbRi: Onkyo RI control
+ * 
+ * Copyright (C) 2021. Mikhail Kulesh
+ *
+ * This program is free software: you can redistribute it and/or modify it under the terms of the GNU
+ * General Public License as published by the Free Software Foundation, either version 3 of the License,
+ * or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without
+ * even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details. You should have received a copy of the GNU General
+ * Public License along with this program.
+ */
+
+#include "FrameStore.h"
+
+using namespace StmPlusPlus;
+
+// The last flash page is reserved in the linker script
+extern "C" const uint8_t _store_start[];
+
+/************************************************************************
+ * Class OnkyoRiFrameStore
+ ************************************************************************/
+
+OnkyoRiFrameStore::OnkyoRiFrameStore () :
+    learnPort { NO_PORT },
+    learnSlot { 0 },
+    durationsCount { 0 },
+    lastEdge { 0 },
+    prevEdge { 0 },
+    started { false },
+    overflow { false }
+{
+    ::memset(&image, 0, sizeof(image));
+    image.magic = MAGIC;
+}
+
+bool OnkyoRiFrameStore::startLearn (uint8_t port, size_t slot)
+{
+    if (slot >= SLOTS_COUNT)
+    {
+        return false;
+    }
+    learnSlot = slot;
+    durationsCount = 0;
+    started = overflow = false;
+    learnPort = port;
+    return true;
+}
+
+void OnkyoRiFrameStore::putEdge (uint32_t time)
+{
+    if (started)
+    {
+        if (durationsCount < MAX_DURATIONS)
+        {
+            const uint32_t d = time - lastEdge;
+            durations[durationsCount] = d > 0xFFFF ? 0xFFFF : d;
+            durationsCount = durationsCount + 1;
+        }
+        else
+        {
+            overflow = true;
+        }
+    }
+    started = true;
+    prevEdge = lastEdge;
+    lastEdge = time;
+}
+
+void OnkyoRiFrameStore::dropEdge ()
+{
+    if (!started || overflow)
+    {
+        return;
+    }
+    if (durationsCount > 0)
+    {
+        durationsCount = durationsCount - 1;
+        lastEdge = prevEdge;
+    }
+    else
+    {
+        started = false;
+    }
+}
+
+int OnkyoRiFrameStore::finishLearn ()
+{
+    learnPort = NO_PORT;
+    if (overflow || durationsCount == 0)
+    {
+        return TOO_LONG;
+    }
+
+    // Merge similar durations into classes: the class value is the average of its members
+    uint32_t sums[MAX_CLASSES];
+    uint8_t counts[MAX_CLASSES];
+    uint8_t indices[MAX_DURATIONS];
+    size_t classesCount = 0;
+    for (size_t i = 0; i < durationsCount; i++)
+    {
+        const uint16_t d = durations[i];
+        size_t c = 0;
+        while (c < classesCount)
+        {
+            const uint32_t average = sums[c] / counts[c];
+            if ((d > average ? d - average : average - d) < DURATION_TOLERANCE)
+            {
+                break;
+            }
+            c++;
+        }
+        if (c == classesCount)
+        {
+            if (classesCount == MAX_CLASSES)
+            {
+                return TOO_IRREGULAR;
+            }
+            sums[c] = counts[c] = 0;
+            classesCount++;
+        }
+        sums[c] += d;
+        counts[c]++;
+        indices[i] = c;
+    }
+
+    uint8_t * data = image.data[learnSlot];
+    size_t length = 0;
+    data[length++] = classesCount;
+    data[length++] = durationsCount;
+    for (size_t c = 0; c < classesCount; c++)
+    {
+        const uint16_t average = (sums[c] + counts[c] / 2) / counts[c];
+        data[length++] = average & 0xFF;
+        data[length++] = average >> 8;
+    }
+    for (size_t i = 0; i < durationsCount; i += 2)
+    {
+        const uint8_t next = i + 1 < durationsCount ? indices[i + 1] : 0;
+        data[length++] = indices[i] | (next << 4);
+    }
+    image.lengths[learnSlot] = length;
+    return length;
+}
+
+size_t OnkyoRiFrameStore::expand (size_t slot, uint16_t * schedule, size_t maxLength) const
+{
+    if (slot >= SLOTS_COUNT || image.lengths[slot] < 2)
+    {
+        return 0;
+    }
+    const uint8_t * data = image.data[slot];
+    const size_t classesCount = data[0];
+    const size_t count = data[1];
+    if (classesCount > MAX_CLASSES || count > MAX_DURATIONS
+        || image.lengths[slot] != 2 + 2 * classesCount + (count + 1) / 2)
+    {
+        return 0;
+    }
+    const uint8_t * classes = data + 2;
+    const uint8_t * indices = classes + 2 * classesCount;
+    size_t n = 0;
+    for (; n < count && n < maxLength; n++)
+    {
+        const size_t c = (indices[n / 2] >> (4 * (n % 2))) & 0x0F;
+        if (c >= classesCount)
+        {
+            return 0;
+        }
+        schedule[n] = classes[2 * c] | (classes[2 * c + 1] << 8);
+    }
+    return n;
+}
+
+bool OnkyoRiFrameStore::load ()
+{
+    const Image * stored = (const Image *) _store_start;
+    if (stored->magic != MAGIC)
+    {
+        return false;
+    }
+    ::memcpy(&image, stored, sizeof(image));
+    return true;
+}
+
+bool OnkyoRiFrameStore::save ()
+{
+    HAL_FLASH_Unlock();
+    FLASH_EraseInitTypeDef erase;
+    erase.TypeErase = FLASH_TYPEERASE_PAGES;
+    erase.PageAddress = (uint32_t) _store_start;
+    erase.NbPages = 1;
+    uint32_t pageError = 0;
+    HAL_StatusTypeDef status = HAL_FLASHEx_Erase(&erase, &pageError);
+    const uint16_t * src = (const uint16_t *) &image;
+    for (size_t i = 0; status == HAL_OK && i < sizeof(image) / 2; i++)
+    {
+        status = HAL_FLASH_Program(FLASH_TYPEPROGRAM_HALFWORD, (uint32_t) _store_start + 2 * i, src[i]);
+    }
+    HAL_FLASH_Lock();
+    return status == HAL_OK;
+}
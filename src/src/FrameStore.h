@@ -0,0 +1,128 @@
+/*
+ * onkyoUsbRi: Onkyo RI control
+ * 
+ * Copyright (C) 2021. Mikhail Kulesh
+ *
+ * This program is free software: you can redistribute it and/or modify it under the terms of the GNU
+ * General Public License as published by the Free Software Foundation, either version 3 of the License,
+ * or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without
+ * even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details. You should have received a copy of the GNU General
+ * Public License along with this program.
+ */
+
+#ifndef FRAME_STORE_H_
+#define FRAME_STORE_H_
+
+#include "BasicIO.h"
+
+namespace StmPlusPlus
+{
+
+/**
+ * @brief Slots with learned raw RI frames.
+ *
+ * A frame is learned as the sequence of durations between its edges (timer ticks of 10 us,
+ * the first duration is a pulse). In a slot, durations that differ by less than
+ * DURATION_TOLERANCE are merged into a class stored with their average, and the sequence is
+ * stored as 4-bit class indices. Slot layout: number of classes, number of durations, the
+ * classes (16 bit, little endian) and the indices (two per byte, the first one in the low
+ * nibble). A standard 12-bit frame has 3 classes and 27 or 28 durations: 22 bytes.
+ *
+ * The slots can be saved into the last flash page and are loaded at startup.
+ */
+class OnkyoRiFrameStore
+{
+public:
+
+    static const size_t SLOTS_COUNT = 8;
+    static const size_t MAX_DURATIONS = 64;
+    static const size_t MAX_CLASSES = 16;
+    static const uint16_t DURATION_TOLERANCE = 10; // 100 us
+    static const size_t SLOT_SIZE = 2 + 2 * MAX_CLASSES + MAX_DURATIONS / 2;
+
+    enum LearnError
+    {
+        TOO_LONG = -1,
+        TOO_IRREGULAR = -2
+    };
+    static const uint8_t NO_PORT = 0xFF;
+
+    OnkyoRiFrameStore ();
+
+    bool startLearn (uint8_t port, size_t slot);
+    void putEdge (uint32_t time);
+
+    /**
+     * @brief Drop the last edge: it started a glitch that was rejected by the input filter.
+     */
+    void dropEdge ();
+
+    /**
+     * @brief Store the learned frame in the learn slot.
+     *
+     * @return the slot length in bytes, or a LearnError. A failed learn leaves the slot unchanged,
+     * so a stored frame is only replaced by a valid one.
+     */
+    int finishLearn ();
+    size_t expand (size_t slot, uint16_t * schedule, size_t maxLength) const;
+
+    bool load ();
+    bool save ();
+
+    inline bool isLearning () const
+    {
+        return learnPort != NO_PORT;
+    }
+
+    inline bool isLearning (uint8_t port) const
+    {
+        return learnPort == port;
+    }
+
+    inline uint8_t getLearnPort () const
+    {
+        return learnPort;
+    }
+
+    inline size_t getLearnSlot () const
+    {
+        return learnSlot;
+    }
+
+    inline size_t getDurationsCount () const
+    {
+        return durationsCount;
+    }
+
+    inline size_t getSize (size_t slot) const
+    {
+        return slot < SLOTS_COUNT ? image.lengths[slot] : 0;
+    }
+
+private:
+
+    static const uint32_t MAGIC = 0x52494632; // "RIF2"
+
+    struct Image
+    {
+        uint32_t magic;
+        uint8_t lengths[SLOTS_COUNT];
+        uint8_t data[SLOTS_COUNT][SLOT_SIZE];
+    };
+
+    Image image;
+
+    // learning
+    volatile uint8_t learnPort;
+    size_t learnSlot;
+    uint16_t durations[MAX_DURATIONS];
+    volatile size_t durationsCount;
+    uint32_t lastEdge, prevEdge;
+    volatile bool started, overflow;
+};
+
+} // end namespace
+#endif
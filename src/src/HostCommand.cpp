@@ -0,0 +1,92 @@
+/*
+ * onkyoUsbRi: Onkyo RI control
+ * 
+ * Copyright (C) 2021. Mikhail Kulesh
+ *
+ * This program is free software: you can redistribute it and/or modify it under the terms of the GNU
+ * General Public License as published by the Free Software Foundation, either version 3 of the License,
+ * or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without
+ * even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details. You should have received a copy of the GNU General
+ * Public License along with this program.
+ */
+
+#include "HostCommand.h"
+
+using namespace StmPlusPlus;
+
+/************************************************************************
+ * Class HostCommand
+ ************************************************************************/
+
+HostCommand::HostCommand ()
+{
+    ::memset(usartBuffer, 0, USART_BUFFER_SIZE);
+}
+
+HostCommand::Command HostCommand::processUsartIrq ()
+{
+    Command command { State::INCOMPLETE, 0, 0 };
+    if (::strlen(usartBuffer) < USART_CMD_LENGHT)
+    {
+        return command;
+    }
+    bool res = false;
+    uint32_t argument = 0;
+    if (usartBuffer[1] == 'x')
+    {
+        command.opcode = usartBuffer[0];
+        res = hexToDecimal(usartBuffer + 2, argument);
+    }
+    else
+    {
+        command.opcode = '0';
+        res = hexToDecimal(usartBuffer, argument);
+    }
+    ::memset(usartBuffer, 0, USART_BUFFER_SIZE - 1);
+    command.argument = uint16_t(argument);
+    command.state = res ? State::VALID : State::INVALID;
+    return command;
+}
+
+bool HostCommand::hexToDecimal (const char * str, uint32_t & decimal)
+{
+    size_t length = ::strlen(str);
+    if (length == 0)
+    {
+        return false;
+    }
+    decimal = 0;
+    uint32_t weight = 1;
+    for(int i = length - 1; i >= 0; --i)
+    {
+        char c = str[i];
+        uint32_t valueOf = 0;
+        switch (c)
+        {
+            case '0': valueOf = 0; break;
+            case '1': valueOf = 1; break;
+            case '2': valueOf = 2; break;
+            case '3': valueOf = 3; break;
+            case '4': valueOf = 4; break;
+            case '5': valueOf = 5; break;
+            case '6': valueOf = 6; break;
+            case '7': valueOf = 7; break;
+            case '8': valueOf = 8; break;
+            case '9': valueOf = 9; break;
+            case 'a': case 'A': valueOf = 10; break;
+            case 'b': case 'B': valueOf = 11; break;
+            case 'c': case 'C': valueOf = 12; break;
+            case 'd': case 'D': valueOf = 13; break;
+            case 'e': case 'E': valueOf = 14; break;
+            case 'f': case 'F': valueOf = 15; break;
+            default : return false;
+        }
+        
+        decimal += weight * valueOf;
+        weight *= 16;
+    }
+    return true;
+}
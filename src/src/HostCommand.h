@@ -0,0 +1,124 @@
+/*
+ * onkyoUsbRi: Onkyo RI control
+ * 
+ * Copyright (C) 2021. Mikhail Kulesh
+ *
+ * This program is free software: you can redistribute it and/or modify it under the terms of the GNU
+ * General Public License as published by the Free Software Foundation, either version 3 of the License,
+ * or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without
+ * even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details. You should have received a copy of the GNU General
+ * Public License along with this program.
+ */
+
+#ifndef HOST_COMMAND_H_
+#define HOST_COMMAND_H_
+
+#include "BasicIO.h"
+
+namespace StmPlusPlus
+{
+
+/**
+ * @brief Parser of the commands received from the host via USART.
+ *
+ * A command has fixed length of 6 characters: "<opcode>x<argument>", where argument
+ * is a hexadecimal number. The digit opcodes '0'...'9' select the RI port the argument
+ * shall be sent to. A command without 'x' at the second position is a legacy RI code
+ * for the port 0.
+ *
+ * Service commands use letter opcodes:
+ * - "Tx<pnnn>": loopback self-test of the port p with nnn frames (0: default number).
+ * - "Gx<pnnn>": set minimal pulse width of the port p input to nnn timer ticks (0: no filter)
+ *   and report the glitch counter.
+ * - "Ix<pnnn>": set the bus idle gap required before transmitting on the port p to nnn ms
+ *   and report collision and deferral counters.
+ * - "Cx<mask>": start raw edge capture of the ports given by the bit mask, or stop it (mask 0).
+ * - "Lx<p0ss>": learn the next frame received on the port p into the slot ss.
+ * - "Rx<p0ss>": replay the frame from the slot ss on the port p.
+ * - "Px0000": save all slots into the flash.
+ * - "Sx000r": report the statistics; reset them afterwards if r is 1.
+ * - "Vx<mmll>": set the runtime log level ll (0: trace ... 4: error, 5: off) of the log
+ *   module mm (FF: all modules).
+ * - "Ax<hsss>": set the comparator threshold sss (DAC units) and the hysteresis h * 32 of the
+ *   analog input (RI_ANALOG_INPUT build setting), or enable the automatic threshold (0000).
+ * - "Nx<ssss>": sequence ID of the next command. A command with a sequence ID is acknowledged
+ *   with "ACK <id> queued|done|rejected|dropped"; RI frames are first queued and then done
+ *   or dropped.
+ *
+ * The command is parsed in the USART interrupt and handed to the main loop by value, so the
+ * receive buffer is the only state shared with the interrupt.
+ */
+class HostCommand
+{
+public:
+    
+    static const size_t USART_BUFFER_SIZE = 10;
+    static const size_t USART_CMD_LENGHT = 6;
+    char usartBuffer[USART_BUFFER_SIZE];
+
+    static const char OPCODE_SELF_TEST = 'T';
+    static const char OPCODE_GLITCH_FILTER = 'G';
+    static const char OPCODE_IDLE_GAP = 'I';
+    static const char OPCODE_CAPTURE = 'C';
+    static const char OPCODE_LEARN = 'L';
+    static const char OPCODE_REPLAY = 'R';
+    static const char OPCODE_SAVE = 'P';
+    static const char OPCODE_STATISTICS = 'S';
+    static const char OPCODE_LOG_LEVEL = 'V';
+    static const char OPCODE_SEQUENCE = 'N';
+    static const char OPCODE_THRESHOLD = 'A';
+
+    enum class State : uint8_t
+    {
+        INCOMPLETE = 0,
+        VALID = 1,
+        INVALID = 2
+    };
+
+    /**
+     * @brief Parsed command: small enough to be stored by value in an event.
+     *
+     * The argument has 16 bits: a legacy command has 6 digits, but only the lower 12 bits of it are
+     * sent as the RI code.
+     */
+    struct Command
+    {
+        State state;
+        char opcode;
+        uint16_t argument;
+
+        inline bool isPortCommand () const
+        {
+            return opcode >= '0' && opcode <= '9';
+        }
+
+        inline size_t getPort () const
+        {
+            return opcode - '0';
+        }
+    };
+
+    HostCommand ();
+
+    /**
+     * @brief Parse the received command and clear the buffer for the next one.
+     *
+     * @return the command, with the state INCOMPLETE as long as the buffer is not complete.
+     */
+    Command processUsartIrq ();
+
+    inline void reset ()
+    {
+        ::memset(usartBuffer, 0, USART_BUFFER_SIZE);
+    }
+
+private:
+
+    bool hexToDecimal (const char * str, uint32_t & decimal);
+};
+
+} // end namespace
+#endif
@@ -0,0 +1,173 @@
+/*
+ * onkyoUsbRi: Onkyo RI control
+ *
+ * Copyright (C) 2021. Mikhail Kulesh
+ *
+ * This program is free software: you can redistribute it and/or modify it under the terms of the GNU
+ * General Public License as published by the Free Software Foundation, either version 3 of the License,
+ * or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without
+ * even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details. You should have received a copy of the GNU General
+ * Public License along with this program.
+ */
+
+#include "LineMonitor.h"
+
+using namespace StmPlusPlus;
+
+// Factory calibration of the internal reference, measured with VDDA = 3.3 V
+#define VREFINT_CAL (*((const uint16_t *) 0x1FFFF7BA))
+
+/************************************************************************
+ * Class LineMonitor
+ ************************************************************************/
+
+LineMonitor::LineMonitor (TimerBase & _timer) :
+    timer { _timer },
+    adc { IOPort::A, GPIO_PIN_7, AnalogToDigitConverter::ADC_2, ADC_CHANNEL_4, 3.3 },
+    referenceSum { 0 },
+    samples { 0 },
+    #ifdef RI_ANALOG_INPUT
+    lineSum { 0 },
+    windowMin { 0xFFFF },
+    windowMax { 0 },
+    #endif
+    dmaPriority { 0 },
+    #ifdef RI_ANALOG_INPUT
+    rawMin { 0 },
+    rawMax { 0 },
+    lineAverage { 0 },
+    lineMin { 0 },
+    lineMax { 0 },
+    idleLevel { NO_LEVEL },
+    prevIdleLevel { NO_LEVEL },
+    frameSwing { 0 },
+    swingWeak { false },
+    #endif
+    supply { 0 },
+    supplyLow { false }
+{
+    // empty
+}
+
+bool LineMonitor::start (const InterruptPriority & prio)
+{
+    #ifdef RI_ANALOG_INPUT
+    static const uint32_t channels[CHANNELS] = { ADC_CHANNEL_VREFINT, ADC_CHANNEL_4 };
+    #else
+    static const uint32_t channels[CHANNELS] = { ADC_CHANNEL_VREFINT };
+    #endif
+    dmaPriority = prio.first;
+    HAL_NVIC_SetPriority(adc.getDmaIrq(), prio.first, prio.second);
+    HAL_NVIC_EnableIRQ(adc.getDmaIrq());
+    timer.setTriggerOutput(TIM_TRGO_UPDATE);
+    if (adc.startContinuous(ADC_EXTERNALTRIGCONV_T6_TRGO, channels, CHANNELS, buffer, 2 * BLOCK_SAMPLES * CHANNELS)
+        != HAL_OK)
+    {
+        return false;
+    }
+    return timer.startCounter(TIM_COUNTERMODE_UP, System::getMcuFreq() / 1000000 - 1, 1000000 / SAMPLE_RATE - 1)
+           == HAL_OK;
+}
+
+void LineMonitor::processBlock (bool secondHalf)
+{
+    const uint16_t * block = buffer + (secondHalf ? BLOCK_SAMPLES * CHANNELS : 0);
+    uint32_t reference = 0;
+    #ifdef RI_ANALOG_INPUT
+    uint32_t line = 0;
+    uint16_t minValue = windowMin, maxValue = windowMax;
+    #endif
+    for (size_t i = 0; i < BLOCK_SAMPLES; i++, block += CHANNELS)
+    {
+        reference += block[0];
+        #ifdef RI_ANALOG_INPUT
+        line += block[1];
+        minValue = block[1] < minValue ? block[1] : minValue;
+        maxValue = block[1] > maxValue ? block[1] : maxValue;
+        #endif
+    }
+    referenceSum = referenceSum + reference;
+    samples = samples + BLOCK_SAMPLES;
+    #ifdef RI_ANALOG_INPUT
+    lineSum = lineSum + line;
+    windowMin = minValue;
+    windowMax = maxValue;
+    #endif
+}
+
+uint32_t LineMonitor::processWindow ()
+{
+    uint32_t n, reference;
+    #ifdef RI_ANALOG_INPUT
+    uint32_t line;
+    #endif
+    {
+        InterruptLock lock(dmaPriority);
+        n = samples;
+        reference = referenceSum;
+        referenceSum = samples = 0;
+        #ifdef RI_ANALOG_INPUT
+        line = lineSum;
+        rawMin = windowMin;
+        rawMax = windowMax;
+        lineSum = 0;
+        windowMin = 0xFFFF;
+        windowMax = 0;
+        #endif
+    }
+    if (n == 0 || reference < n)
+    {
+        return NONE;
+    }
+
+    supply = 3300 * VREFINT_CAL / (reference / n);
+
+    uint32_t changes = NONE;
+    if ((supply < MIN_SUPPLY) != supplyLow)
+    {
+        supplyLow = !supplyLow;
+        changes |= SUPPLY;
+    }
+    #ifdef RI_ANALOG_INPUT
+    changes |= processLine(line, n);
+    #endif
+    return changes;
+}
+
+#ifdef RI_ANALOG_INPUT
+uint32_t LineMonitor::processLine (uint32_t line, uint32_t n)
+{
+    lineAverage = toMilliVolt(line / n);
+    lineMin = toMilliVolt(rawMin);
+    lineMax = toMilliVolt(rawMax);
+
+    uint32_t changes = NONE;
+    if (lineMax - lineMin < QUIET_SWING)
+    {
+        // No frames: the average is the idle level. Small drifts are followed silently
+        const uint32_t step = lineAverage > idleLevel ? lineAverage - idleLevel : idleLevel - lineAverage;
+        if (idleLevel != NO_LEVEL && step >= IDLE_STEP)
+        {
+            prevIdleLevel = idleLevel;
+            changes |= IDLE_LEVEL;
+        }
+        idleLevel = lineAverage;
+    }
+    else if (idleLevel != NO_LEVEL)
+    {
+        // Frames: the level farthest from the idle level, independent of the line polarity
+        const uint32_t up = lineMax > idleLevel ? lineMax - idleLevel : 0;
+        const uint32_t down = idleLevel > lineMin ? idleLevel - lineMin : 0;
+        frameSwing = up > down ? up : down;
+        if ((frameSwing < MIN_FRAME_SWING) != swingWeak)
+        {
+            swingWeak = !swingWeak;
+            changes |= FRAME_SWING;
+        }
+    }
+    return changes;
+}
+#endif
@@ -0,0 +1,186 @@
+/*
+ * onkyoUsbRi: Onkyo RI control
+ *
+ * Copyright (C) 2021. Mikhail Kulesh
+ *
+ * This program is free software: you can redistribute it and/or modify it under the terms of the GNU
+ * General Public License as published by the Free Software Foundation, either version 3 of the License,
+ * or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without
+ * even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details. You should have received a copy of the GNU General
+ * Public License along with this program.
+ */
+
+#ifndef LINE_MONITOR_H_
+#define LINE_MONITOR_H_
+
+#include "BasicIO.h"
+
+namespace StmPlusPlus
+{
+
+/**
+ * @brief Continuous monitoring of the RI line level and of the supply voltage.
+ *
+ * ADC2 converts the line (PA7) and the internal reference at each update event of a trigger timer
+ * (10 kHz); the DMA writes the results into a circular buffer. Each completed half of the buffer is
+ * accumulated in the DMA interrupt (sum, minimum and maximum), so the main loop only reads the
+ * results of a window. The supply voltage VDDA is derived from the internal reference and its
+ * factory calibration.
+ *
+ * At the end of each window, the idle level of the line is updated from a window without frames,
+ * and the frame swing (the level farthest from the idle level) from a window with frames. A change of the idle
+ * level, a weak swing or a low supply is reported once per transition.
+ *
+ * PA7 is only the RI line with the RI_ANALOG_INPUT build setting. Otherwise, the line of the port 0 is a
+ * digital EXTI input that cannot be converted, and only the internal reference is sampled.
+ */
+class LineMonitor
+{
+public:
+
+    #ifdef RI_ANALOG_INPUT
+    static const size_t CHANNELS = 2; // internal reference, line
+    #else
+    static const size_t CHANNELS = 1; // internal reference
+    #endif
+    static const size_t BLOCK_SAMPLES = 16; // samples per channel in each half of the buffer
+    static const uint32_t SAMPLE_RATE = 10000; // Hz
+
+    #ifdef RI_ANALOG_INPUT
+    static const uint32_t QUIET_SWING = 300; // mV: a window with a smaller swing has no frames
+    static const uint32_t IDLE_STEP = 500; // mV: idle level change reported as a device power change
+    static const uint32_t MIN_FRAME_SWING = 2000; // mV: frames with a smaller swing are weak
+    #endif
+    static const uint32_t MIN_SUPPLY = 3000; // mV
+    static const uint32_t NO_LEVEL = __UINT32_MAX__;
+
+    enum Change
+    {
+        NONE = 0,
+        SUPPLY = 1,
+        IDLE_LEVEL = 2,
+        FRAME_SWING = 4
+    };
+
+    LineMonitor (TimerBase & _timer);
+    bool start (const InterruptPriority & prio);
+
+    inline void processDmaInterrupt ()
+    {
+        adc.processDmaInterrupt();
+    }
+
+    /**
+     * @brief Accumulate the completed half of the DMA buffer: called from the conversion callbacks.
+     */
+    void processBlock (bool secondHalf);
+
+    /**
+     * @brief Evaluate the samples since the last call.
+     *
+     * @return mask of Change flags for the states that changed in this window.
+     */
+    uint32_t processWindow ();
+
+    inline uint32_t getSupply () const
+    {
+        return supply;
+    }
+
+    inline bool isSupplyLow () const
+    {
+        return supplyLow;
+    }
+
+    #ifdef RI_ANALOG_INPUT
+    inline uint32_t getLineAverage () const
+    {
+        return lineAverage;
+    }
+
+    inline uint32_t getLineMin () const
+    {
+        return lineMin;
+    }
+
+    inline uint32_t getLineMax () const
+    {
+        return lineMax;
+    }
+
+    inline uint32_t getIdleLevel () const
+    {
+        return idleLevel;
+    }
+
+    inline uint32_t getPrevIdleLevel () const
+    {
+        return prevIdleLevel;
+    }
+
+    inline uint32_t getFrameSwing () const
+    {
+        return frameSwing;
+    }
+
+    inline bool isSwingWeak () const
+    {
+        return swingWeak;
+    }
+
+    /**
+     * @brief Line level in ADC units (as used by the comparator threshold) of the last window.
+     */
+    inline uint32_t getRawMin () const
+    {
+        return rawMin;
+    }
+
+    inline uint32_t getRawMax () const
+    {
+        return rawMax;
+    }
+    #endif
+
+private:
+
+    TimerBase & timer;
+    AnalogToDigitConverter adc;
+    uint16_t buffer[2 * BLOCK_SAMPLES * CHANNELS];
+
+    // Accumulators of the current window: written by the DMA interrupt
+    volatile uint32_t referenceSum, samples;
+    #ifdef RI_ANALOG_INPUT
+    volatile uint32_t lineSum;
+    volatile uint16_t windowMin, windowMax;
+    #endif
+
+    // Only the DMA interrupt is masked while the accumulators are read
+    uint32_t dmaPriority;
+
+    // Results of the last window
+    #ifdef RI_ANALOG_INPUT
+    uint32_t rawMin, rawMax;
+    uint32_t lineAverage, lineMin, lineMax;
+    uint32_t idleLevel, prevIdleLevel, frameSwing;
+    bool swingWeak;
+    #endif
+    uint32_t supply;
+    bool supplyLow;
+
+    #ifdef RI_ANALOG_INPUT
+
+    inline uint32_t toMilliVolt (uint32_t raw) const
+    {
+        return raw * supply / 4095;
+    }
+
+    uint32_t processLine (uint32_t line, uint32_t n);
+    #endif
+};
+
+} // end namespace
+#endif
@@ -0,0 +1,80 @@
+/*
+ * onkyoUsbRi: Onkyo RI control
+ *
+ * Copyright (C) 2021. Mikhail Kulesh
+ *
+ * This program is free software: you can redistribute it and/or modify it under the terms of the GNU
+ * General Public License as published by the Free Software Foundation, either version 3 of the License,
+ * or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without
+ * even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details. You should have received a copy of the GNU General
+ * Public License along with this program.
+ */
+
+#include "NumberFormat.h"
+
+using namespace StmPlusPlus;
+
+/************************************************************************
+ * Class NumberFormat
+ ************************************************************************/
+
+const char * NumberFormat::format (char (& buffer)[BUFFER_SIZE], uint64_t n, bool negative, uint32_t radix,
+                                   uint8_t width, char fill)
+{
+    static const char * const DIGITS = "0123456789abcdef";
+
+    char * p = buffer + BUFFER_SIZE;
+    *--p = 0;
+    if (radix == 16)
+    {
+        do
+        {
+            *--p = DIGITS[n & 0xF];
+            n >>= 4;
+        }
+        while (n != 0);
+    }
+    else
+    {
+        // The 64-bit division is a library call: only use it for the upper digits
+        while (n > 0xFFFFFFFF)
+        {
+            *--p = DIGITS[n % 10];
+            n /= 10;
+        }
+        uint32_t v = n;
+        do
+        {
+            *--p = DIGITS[v % 10];
+            v /= 10;
+        }
+        while (v != 0);
+    }
+
+    const size_t prefix = radix == 16 ? 2 : (negative ? 1 : 0);
+    size_t length = (buffer + BUFFER_SIZE - 1 - p) + prefix;
+    if (fill == '0')
+    {
+        for (; length < width && p > buffer + prefix; length++)
+        {
+            *--p = '0';
+        }
+    }
+    if (radix == 16)
+    {
+        *--p = 'x';
+        *--p = '0';
+    }
+    else if (negative)
+    {
+        *--p = '-';
+    }
+    for (; length < width && p > buffer; length++)
+    {
+        *--p = fill;
+    }
+    return p;
+}
@@ -0,0 +1,48 @@
+/*
+ * onkyoUsbRi: Onkyo RI control
+ *
+ * Copyright (C) 2021. Mikhail Kulesh
+ *
+ * This program is free software: you can redistribute it and/or modify it under the terms of the GNU
+ * General Public License as published by the Free Software Foundation, either version 3 of the License,
+ * or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without
+ * even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details. You should have received a copy of the GNU General
+ * Public License along with this program.
+ */
+
+#ifndef NUMBER_FORMAT_H_
+#define NUMBER_FORMAT_H_
+
+#include <cstddef>
+#include <cstdint>
+
+namespace StmPlusPlus
+{
+
+/**
+ * @brief Number formatter of UsartLogger.
+ *
+ * The digits are written from the end of the given buffer, so no reverse pass is needed, and the
+ * text (with the sign or the 0x prefix, padded to the given width) ends with a null character in
+ * the last byte of the buffer. The formatter does not depend on the HAL, so it can be measured on
+ * the host (see host/numberbench.cpp).
+ */
+class NumberFormat
+{
+public:
+
+    // Fits a 64-bit number with sign or hex prefix and a reasonable padding
+    static const size_t BUFFER_SIZE = 24;
+
+    /**
+     * @brief Format the magnitude n with the given radix (10 or 16): returns the start of the text.
+     */
+    static const char * format (char (& buffer)[BUFFER_SIZE], uint64_t n, bool negative, uint32_t radix,
+                                uint8_t width = 0, char fill = ' ');
+};
+
+} // end namespace
+#endif
@@ -19,165 +19,299 @@
 using namespace StmPlusPlus;
 
 /************************************************************************
- * Class OnkyoRiInputProcessor
+ * Class OnkyoRiOutputProcessor
  ************************************************************************/
 
-OnkyoRiInputProcessor::OnkyoRiInputProcessor (TimerBase::TimerName _inTimer) :
+OnkyoRiOutputProcessor::OnkyoRiOutputProcessor (IOPin & _outPin, TimerBase & _timer, uint32_t _channel,
+                                                OnkyoRiStatistics & _statistics) :
+    pin { _outPin },
+    timer { _timer },
+    channel { _channel },
+    statistics { _statistics },
     command { 0 },
-    timer { _inTimer },
-    tick { 0 }
+    scheduleLength { 0 },
+    step { 0 },
+    busy { false }
 {
-    timer.startCounter(TIM_COUNTERMODE_UP, System::getMcuFreq()/100000, 0xFFFF, TIM_CLOCKDIVISION_DIV1);
+    // empty
 }
 
-int OnkyoRiInputProcessor::processPinIrq (bool pinValue)
+bool OnkyoRiOutputProcessor::send (uint32_t _command)
 {
-    uint32_t time = timer.getValue();
-    Direction dir = pinValue ? Direction::UP : Direction::DOWN;
-    timer.reset();
-    if (dir == Direction::UP && time > 250 && time < 350)
+    if (busy)
     {
-        // Header: 3 ms
-        return 2;
+        return false;
     }
-    else if (dir == Direction::DOWN && time > 150 && time < 250)
+    command = _command;
+    std::bitset<RI_BITS_COUNT> outBits(command);
+    scheduleLength = 0;
+    // header
+    outTick(300, 100);
+    // body
+    for (int i = outBits.size() - 1; i >= 0; i--)
     {
-        // High bit: 2 ms
-        return 1;
+        if (outBits[i])
+        {
+            outTick(100, 200);
+        }
+        else
+        {
+            outTick(100, 100);
+        }
     }
-    else if (dir == Direction::DOWN && time > 50 && time < 150)
-    {
-        // Low bit: 1 ms
-        return 0;
-    }            
-    return -1;
+    // trailer
+    outTick(100, 100);   
+    startSchedule();
+    return true;
 }
 
-void OnkyoRiInputProcessor::processMsgStart ()
+bool OnkyoRiOutputProcessor::sendSchedule (const uint16_t * _schedule, size_t length, uint32_t _command)
 {
-    bits.reset();
-    tick = 0;        
-    command = 0;
+    if (busy || length == 0 || length > SCHEDULE_LENGTH)
+    {
+        return false;
+    }
+    command = _command;
+    ::memcpy(schedule, _schedule, length * sizeof(uint16_t));
+    scheduleLength = length;
+    startSchedule();
+    return true;
 }
 
-bool OnkyoRiInputProcessor::processMsgBit (bool bit)
+bool OnkyoRiOutputProcessor::processTimerIrq ()
 {
-    if (tick > 0 && tick <= RI_BITS_COUNT)
+    if (step < scheduleLength)
     {
-        bits[RI_BITS_COUNT - tick] = bit;
-    }
-    tick++;
-    if (tick > RI_BITS_COUNT)
-    {
-        tick = 0;
-        command = bits.to_ulong();
+        // even steps are high pulses, odd steps are pauses
+        pin.putBit(step % 2 == 0);
+        timer.setCompare(channel, (timer.getCompare(channel) + schedule[step]) & TIMER_MASK);
+        step = step + 1;
+        return false;
     }
-    return command > 0;
+    pin.setLow();
+    timer.disableCompareIt(channel);
+    statistics.txFrames++;
+    busy = false;
+    return true;
+}
+
+void OnkyoRiOutputProcessor::outTick (uint16_t d1, uint16_t d2)
+{
+    schedule[scheduleLength++] = d1;
+    schedule[scheduleLength++] = d2;
+}
+
+void OnkyoRiOutputProcessor::startSchedule ()
+{
+    busy = true;
+    step = 1;
+    // The first pulse is measured from the pin change: an interrupt in between would lengthen it
+    InterruptLock lock(START_LOCK_PRIORITY);
+    pin.setHigh();
+    timer.setCompare(channel, (timer.getValue() + schedule[0]) & TIMER_MASK);
+    timer.enableCompareIt(channel);
 }
 
 /************************************************************************
- * Class OnkyoRiOutputProcessor
+ * Class OnkyoRiPort
  ************************************************************************/
 
-OnkyoRiOutputProcessor::OnkyoRiOutputProcessor (IOPin & _outPin, TimerBase::TimerName _outTimer) :
-    command { 0 },
-    pin { _outPin },
-    timer { _outTimer }
+OnkyoRiPort::OnkyoRiPort (uint8_t _id, const Config & _config, bool enabled, const TimerBase & _rxTimer,
+                          TimerBase & txTimer, OnkyoRiFrameStore & _store) :
+    id { _id },
+    config { _config },
+    capture { NULL },
+    input { _config.inPort, _config.inPin, GPIO_MODE_IT_RISING_FALLING, GPIO_NOPULL, GPIO_SPEED_HIGH, enabled },
+    output { _config.outPort, _config.outPin, GPIO_MODE_OUTPUT_PP, GPIO_NOPULL, GPIO_SPEED_HIGH, enabled },
+    inputProcessor { statistics },
+    outputProcessor { output, txTimer, _config.txChannel, statistics },
+    rxTimer { _rxTimer },
+    store { _store },
+    lastActivity { 0 },
+    txStart { 0 },
+    txEnd { 0 },
+    txEdges { 0 },
+    txActive { false },
+    txEnded { false },
+    txSettledAt { 0 },
+    txSettled { false },
+    idleGap { DEFAULT_IDLE_GAP },
+    backoffUntil { 0 },
+    random { _id + 1U },
+    current { 0, NO_SEQUENCE },
+    echo { Echo::NONE },
+    retries { 0 },
+    hasCurrent { false }
 {
-    ::memset(usartBuffer, 0, USART_BUFFER_SIZE - 1);
+    statistics.reset();
 }
 
-bool OnkyoRiOutputProcessor::processUsartIrq()
+int OnkyoRiPort::processExtiIrq ()
 {
-    if (::strlen(usartBuffer) < USART_CMD_LENGHT)
+    int val = -1;
+    if (__HAL_GPIO_EXTI_GET_FLAG(config.inPin))
     {
-        command = 0;
-        return false;
+        val = processEdge(input.getBit(), rxTimer.getValue());
     }
-    else
-    {
-        bool res = hexToDecimal(usartBuffer, command);
-        ::memset(usartBuffer, 0, USART_BUFFER_SIZE - 1);
-        return res;
-    }        
+    HAL_GPIO_EXTI_IRQHandler(config.inPin);
+    return val;
 }
 
-void OnkyoRiOutputProcessor::sendBlocking()
+int OnkyoRiPort::processEdge (bool pinValue, uint32_t now)
 {
-    timer.startCounter(TIM_COUNTERMODE_UP, System::getMcuFreq()/100000, 0xFFFF, TIM_CLOCKDIVISION_DIV1);
-    std::bitset<RI_BITS_COUNT> outBits(command);
-    // header
-    outTick(300, 100);
-    // body
-    for (int i = outBits.size() - 1; i >= 0; i--)
+    lastActivity = now;
+    if (capture != NULL)
     {
-        if (outBits[i])
+        capture->put(id, pinValue, now);
+    }
+    // Own frame is visible on the input while transmitting: it is decoded as well and verified
+    // by processRxFrame(), but it is not learned
+    if (isTxEdge(now))
+    {
+        txEdges = txEdges + 1;
+    }
+    else if (!outputProcessor.isBusy() && store.isLearning(id))
+    {
+        // Learned edges pass the same glitch filter as the decoded ones
+        if (inputProcessor.isGlitch(now))
         {
-            outTick(100, 200);
+            store.dropEdge();
         }
         else
         {
-            outTick(100, 100);
+            store.putEdge(now);
         }
     }
-    // trailer
-    outTick(100, 100);   
-    timer.stopCounter();
+    return inputProcessor.processPinIrq(pinValue, now);
 }
 
-void OnkyoRiOutputProcessor::outTick(uint32_t d1, uint32_t d2)
+bool OnkyoRiPort::isBusIdle () const
 {
-    timer.reset();
-    pin.setHigh();
-    while(timer.getValue() < d1);
-    timer.reset();
-    pin.setLow();
-    while(timer.getValue() < d2);
+    // rx timer: 100 ticks per ms
+    return rxTimer.getValue() - lastActivity >= idleGap * 100;
 }
 
-bool OnkyoRiOutputProcessor::hexToDecimal(const char * str, uint32_t & decimal)
+bool OnkyoRiPort::processTx (uint32_t now)
 {
-    size_t length = ::strlen(str);
-    if (length == 0 || str[length - 1] == 'x')
+    if (outputProcessor.isBusy() || txActive || (!hasCurrent && txQueue.empty()) || int32_t(now - backoffUntil) < 0)
     {
         return false;
     }
-    decimal = 0;
-    uint32_t weight = 1;
-    for(int i = length - 1; i >= 0; --i)
+    if (!isBusIdle())
     {
-        char c = str[i];
-        if (c == 'x')
-        {
-            break;
-        }
-        
-        uint32_t valueOf = 0;
-        switch (c)
+        statistics.txDeferrals++;
+        backoffUntil = now + getBackoff();
+        return false;
+    }
+    if (!hasCurrent)
+    {
+        current = txQueue.get();
+        hasCurrent = true;
+        retries = 0;
+    }
+    txStart = rxTimer.getValue();
+    txEdges = 0;
+    txEnded = false;
+    txSettled = false;
+    txActive = true;
+    echo = Echo::EXPECTED;
+    if (current.code & REPLAY_FLAG)
+    {
+        uint16_t schedule[OnkyoRiOutputProcessor::SCHEDULE_LENGTH];
+        const size_t length = store.expand(current.code & ~REPLAY_FLAG, schedule,
+                                           OnkyoRiOutputProcessor::SCHEDULE_LENGTH);
+        if (length == 0)
         {
-            case '0': valueOf = 0; break;
-            case '1': valueOf = 1; break;
-            case '2': valueOf = 2; break;
-            case '3': valueOf = 3; break;
-            case '4': valueOf = 4; break;
-            case '5': valueOf = 5; break;
-            case '6': valueOf = 6; break;
-            case '7': valueOf = 7; break;
-            case '8': valueOf = 8; break;
-            case '9': valueOf = 9; break;
-            case 'a': case 'A': valueOf = 10; break;
-            case 'b': case 'B': valueOf = 11; break;
-            case 'c': case 'C': valueOf = 12; break;
-            case 'd': case 'D': valueOf = 13; break;
-            case 'e': case 'E': valueOf = 14; break;
-            case 'f': case 'F': valueOf = 15; break;
-            default : return false;
+            // empty slot: nothing to replay
+            hasCurrent = false;
+            txActive = false;
+            echo = Echo::NONE;
+            return false;
         }
-        
-        decimal += weight * valueOf;
-        weight *= 16;
+        return outputProcessor.sendSchedule(schedule, length, current.code);
+    }
+    return outputProcessor.send(current.code);
+}
+
+OnkyoRiPort::RxResult OnkyoRiPort::processRxFrame (uint32_t code)
+{
+    if (echo != Echo::EXPECTED)
+    {
+        return RxResult::FRAME;
+    }
+    // The code of a replayed frame is not known: any frame is its echo
+    if ((current.code & REPLAY_FLAG) || code == (current.code & RI_CODE_MASK))
+    {
+        echo = Echo::MATCHED;
+        statistics.txVerified++;
+        return RxResult::ECHO;
+    }
+    echo = Echo::CORRUPTED;
+    statistics.txCorrupted++;
+    return RxResult::CORRUPTED;
+}
+
+bool OnkyoRiPort::processTxTimerIrq ()
+{
+    if (!outputProcessor.processTimerIrq())
+    {
+        return false;
+    }
+    if (txActive)
+    {
+        txEnd = rxTimer.getValue();
+        txEnded = true;
     }
     return true;
 }
 
+OnkyoRiPort::TxResult OnkyoRiPort::processTxDone (uint32_t now, uint32_t inputTime)
+{
+    if (!txActive || !txEnded || int32_t(inputTime - txEnd) <= int32_t(TX_EDGE_SLACK))
+    {
+        return TxResult::PENDING;
+    }
+    // No edges at all: the own output is not visible on the input, nothing to compare and no echo
+    // to wait for. Otherwise, the echo may still wait in the RX event queue: a late echo shall not
+    // be logged as a foreign frame, and its code decides the retry. A frame that is not decoded
+    // at all (for example the code 0) is not checked.
+    const uint32_t edges = txEdges;
+    if (!txSettled)
+    {
+        txSettled = true;
+        txSettledAt = now;
+    }
+    if (edges != 0 && echo == Echo::EXPECTED && now - txSettledAt < ECHO_TIMEOUT)
+    {
+        return TxResult::PENDING;
+    }
+    const bool collision = edges != 0 && edges != outputProcessor.getEdgesCount();
+    const bool corrupted = echo == Echo::CORRUPTED;
+    txActive = false;
+    echo = Echo::NONE;
+    if (collision || corrupted)
+    {
+        statistics.txCollisions += collision ? 1 : 0;
+        if (++retries <= MAX_RETRIES)
+        {
+            backoffUntil = now + idleGap + getBackoff();
+            return TxResult::COLLISION;
+        }
+        statistics.txDropped++;
+        hasCurrent = false;
+        return TxResult::DROPPED;
+    }
+    hasCurrent = false;
+    return TxResult::DONE;
+}
 
+uint32_t OnkyoRiPort::getBackoff ()
+{
+    // xorshift32 mixed with the timer value, so that adapters on the same bus diverge
+    random ^= rxTimer.getValue();
+    random = random != 0 ? random : 1;
+    random ^= random << 13;
+    random ^= random >> 17;
+    random ^= random << 5;
+    return 1 + random % MAX_BACKOFF;
+}
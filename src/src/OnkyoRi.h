@@ -18,59 +18,247 @@
 
 #include <bitset>
 #include "BasicIO.h"
+#include "EventQueue.h"
+#include "EdgeCapture.h"
+#include "FrameStore.h"
+#include "OnkyoRiInput.h"
 
 namespace StmPlusPlus
 {
 
-class OnkyoRiInputProcessor
+/**
+ * @brief Encoder of the outgoing RI frames.
+ *
+ * The frame is converted into a schedule of pulse durations that is played by the compare
+ * interrupt of the given channel of a free-running timer shared between all RI ports.
+ * A learned raw schedule can be played the same way.
+ */
+class OnkyoRiOutputProcessor
 {
 public:
     
-    uint32_t command;
-   
-    OnkyoRiInputProcessor (TimerBase::TimerName _inTimer);
-    int processPinIrq (bool pinValue);
-    void processMsgStart ();
-    bool processMsgBit (bool bit);
-    
-private:
-    
-    enum Direction
+    static const size_t SCHEDULE_LENGTH = OnkyoRiFrameStore::MAX_DURATIONS;
+
+    // Interrupts with this priority and lower ones are masked while a schedule starts: only the
+    // TX timer interrupt shall have a higher priority
+    static const uint32_t START_LOCK_PRIORITY = 1;
+
+    OnkyoRiOutputProcessor (IOPin & _outPin, TimerBase & _timer, uint32_t _channel, OnkyoRiStatistics & _statistics);
+    bool send (uint32_t _command);
+    bool sendSchedule (const uint16_t * _schedule, size_t length, uint32_t _command);
+    bool processTimerIrq ();
+
+    inline bool isBusy () const
     {
-        UP = 0,
-        DOWN = 1
-    };
-    
-    static const size_t RI_BITS_COUNT = 12;
-    std::bitset<RI_BITS_COUNT> bits;
-    TimerBase timer;
-    size_t tick;    
-};
+        return busy;
+    }
 
-class OnkyoRiOutputProcessor
-{
-public:
-    
-    uint32_t command;
-    
-    static const size_t USART_BUFFER_SIZE = 10;
-    static const size_t USART_CMD_LENGHT = 6;
-    char usartBuffer[USART_BUFFER_SIZE];
-    
-    OnkyoRiOutputProcessor (IOPin & _outPin, TimerBase::TimerName _outTimer);
-    bool processUsartIrq ();
-    void sendBlocking ();
+    inline uint32_t getCommand () const
+    {
+        return command;
+    }
+
+    /**
+     * @brief Returns the number of output edges of the current schedule.
+     *
+     * A schedule with odd length ends with a pulse that is closed by one more edge.
+     */
+    inline size_t getEdgesCount () const
+    {
+        return (scheduleLength + 1) & ~1U;
+    }
     
 private:
    
     static const size_t RI_BITS_COUNT = 12;
+    static const uint32_t TIMER_MASK = 0xFFFF;
+
     IOPin & pin;
-    TimerBase timer;
+    TimerBase & timer;
+    uint32_t channel;
+    OnkyoRiStatistics & statistics;
+    uint32_t command;
+    uint16_t schedule[SCHEDULE_LENGTH];
+    size_t scheduleLength;
+    volatile size_t step;
+    volatile bool busy;
 
-    void outTick (uint32_t d1, uint32_t d2);
-    bool hexToDecimal(const char * str, uint32_t & decimal);
+    void outTick (uint16_t d1, uint16_t d2);
+    void startSchedule ();
 };
 
+/**
+ * @brief Single RI bus: input and output pins with own decoder, encoder and TX queue.
+ *
+ * Carrier sense: a queued command is only sent when the bus has been idle for the configured
+ * gap; if the bus is busy, the port backs off for a random time. A collision is detected when
+ * the input sees a different number of edges during the transmission than the own frame has.
+ * The edges are assigned to the transmission by their time stamps, and the transmission is only
+ * evaluated when the input has been processed past its end: the sampled input delivers the edges
+ * up to a DMA block later. The collided frame is repeated after a backoff up to MAX_RETRIES times.
+ *
+ * Full duplex: the input is decoded during the transmission as well. The first frame decoded
+ * while an own frame is sent, or within ECHO_TIMEOUT after its end, is its echo: it is verified
+ * against the sent code, and a different code is handled as a collision. Since the decoded frame
+ * may wait in the RX event queue, the retry decision is made only when the echo has been decoded
+ * or the timeout has expired. Frames decoded at any other time come from other devices.
+ */
+class OnkyoRiPort
+{
+public:
+
+    /**
+     * @brief Hardware resources of a port.
+     */
+    struct Config
+    {
+        IOPort::PortName inPort;
+        uint16_t inPin;
+        IRQn_Type inIrq;
+        IOPort::PortName outPort;
+        uint16_t outPin;
+        uint32_t txChannel;
+    };
+
+    enum class TxResult
+    {
+        DONE = 0,
+        COLLISION = 1,
+        DROPPED = 2,
+        PENDING = 3
+    };
+
+    enum class RxResult
+    {
+        FRAME = 0,
+        ECHO = 1,
+        CORRUPTED = 2
+    };
+
+    // TX queue entries with this flag replay the learned frame from the given slot
+    static const uint32_t REPLAY_FLAG = 0x80000000;
+    // Bits of a code that are sent
+    static const uint32_t RI_CODE_MASK = 0xFFF;
+    static const int32_t NO_SEQUENCE = -1;
+
+    /**
+     * @brief Entry of the TX queue: RI code or replay slot, and the host sequence ID if any.
+     */
+    struct TxRequest
+    {
+        uint32_t code;
+        int32_t sequence;
+    };
+
+    static const size_t TX_QUEUE_SIZE = 4;
+    static const uint32_t DEFAULT_IDLE_GAP = 20; // ms
+    static const uint32_t MAX_BACKOFF = 16; // ms
+    static const uint32_t MAX_RETRIES = 3;
+    // RX timer ticks: an input edge this late after the last output edge still belongs to the frame
+    static const uint32_t TX_EDGE_SLACK = 10;
+    // ms after the evaluation of the edges to wait for the decoded echo: as the RX frame timeout
+    static const uint32_t ECHO_TIMEOUT = 60;
+
+    const uint8_t id;
+    const Config & config;
+    EdgeCapture * volatile capture;
+    OnkyoRiStatistics statistics;
+    IOPin input, output;
+    OnkyoRiInputProcessor inputProcessor;
+    OnkyoRiOutputProcessor outputProcessor;
+    EventQueue<TxRequest, TX_QUEUE_SIZE> txQueue;
+
+    OnkyoRiPort (uint8_t _id, const Config & _config, bool enabled, const TimerBase & _rxTimer, TimerBase & txTimer,
+                 OnkyoRiFrameStore & _store);
+
+    inline void startInterrupt (const InterruptPriority & prio)
+    {
+        HAL_NVIC_SetPriority(config.inIrq, prio.first, prio.second);
+        HAL_NVIC_EnableIRQ(config.inIrq);
+    }
+
+    int processExtiIrq ();
+
+    /**
+     * @brief Process an input edge with the given level after the edge and RX timer value.
+     *
+     * Called by the EXTI interrupt, or by the analog front end that captures the edge time.
+     */
+    int processEdge (bool pinValue, uint32_t now);
+
+    bool isBusIdle () const;
+    bool processTx (uint32_t now);
+
+    /**
+     * @brief Classify a decoded frame as a foreign frame, the echo of the own frame, or a corrupted echo.
+     */
+    RxResult processRxFrame (uint32_t code);
+
+    /**
+     * @brief Handle the TX timer interrupt of the port: returns true when the frame is done.
+     */
+    bool processTxTimerIrq ();
+
+    /**
+     * @brief Evaluate the finished transmission by the input edges seen during it.
+     *
+     * The input shall be processed up to the given RX timer value: until it passes the end of the
+     * frame, and then until the echo is decoded or ECHO_TIMEOUT expires, PENDING is returned.
+     */
+    TxResult processTxDone (uint32_t now, uint32_t inputTime);
+
+    inline void setIdleGap (uint32_t _idleGap)
+    {
+        idleGap = _idleGap;
+    }
+
+    inline uint32_t getIdleGap () const
+    {
+        return idleGap;
+    }
+
+    /**
+     * @brief Sequence ID of the request sent last: valid after processTxDone().
+     */
+    inline int32_t getTxSequence () const
+    {
+        return current.sequence;
+    }
+
+
+private:
+
+    enum class Echo : uint8_t
+    {
+        NONE = 0,
+        EXPECTED = 1,
+        MATCHED = 2,
+        CORRUPTED = 3
+    };
+
+    const TimerBase & rxTimer;
+    OnkyoRiFrameStore & store;
+    volatile uint32_t lastActivity;
+    // Transmission window in RX timer ticks: set by the main loop and the TX interrupt
+    volatile uint32_t txStart, txEnd, txEdges;
+    volatile bool txActive, txEnded;
+    // HAL tick when all edges of the transmission have been counted
+    uint32_t txSettledAt;
+    bool txSettled;
+    uint32_t idleGap, backoffUntil, random;
+    TxRequest current;
+    Echo echo;
+    uint32_t retries;
+    bool hasCurrent;
+
+    uint32_t getBackoff ();
+
+    inline bool isTxEdge (uint32_t now) const
+    {
+        return txActive && int32_t(now - txStart) >= 0
+               && (!txEnded || int32_t(now - txEnd) <= int32_t(TX_EDGE_SLACK));
+    }
+};
 
 } // end namespace
 #endif
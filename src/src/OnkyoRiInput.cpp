@@ -0,0 +1,132 @@
+/*
+ * onkyoUsbRi: Onkyo RI control
+ * 
+ * Copyright (C) 2021. Mikhail Kulesh
+ *
+ * This program is free software: you can redistribute it and/or modify it under the terms of the GNU
+ * General Public License as published by the Free Software Foundation, either version 3 of the License,
+ * or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without
+ * even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details. You should have received a copy of the GNU General
+ * Public License along with this program.
+ */
+
+#include "OnkyoRiInput.h"
+
+using namespace StmPlusPlus;
+
+/************************************************************************
+ * Class OnkyoRiInputProcessor
+ ************************************************************************/
+
+OnkyoRiInputProcessor::OnkyoRiInputProcessor (OnkyoRiStatistics & _statistics) :
+    command { 0 },
+    statistics { _statistics },
+    lastEdge { 0 },
+    prevEdge { 0 },
+    pending { -1 },
+    minPulse { DEFAULT_MIN_PULSE },
+    tick { 0 },
+    receiving { false },
+    histogram { NULL }
+{
+    // empty
+}
+
+int OnkyoRiInputProcessor::processPinIrq (bool pinValue, uint32_t now)
+{
+    uint32_t time = now - lastEdge;
+    if (time < minPulse)
+    {
+        // Glitch: drop both its edges and measure the next edge from the last valid one
+        lastEdge = prevEdge;
+        pending = -1;
+        statistics.rxGlitches++;
+        return -1;
+    }
+    prevEdge = lastEdge;
+    lastEdge = now;
+    int val = pending;
+    pending = classify(pinValue, time);
+    return val;
+}
+
+int OnkyoRiInputProcessor::classify (bool pinValue, uint32_t time)
+{
+    Direction dir = pinValue ? Direction::UP : Direction::DOWN;
+    int val = -1;
+    uint32_t nominal = 0;
+    if (dir == Direction::UP && time > 250 && time < 350)
+    {
+        // Header: 3 ms
+        val = 2;
+        nominal = 300;
+    }
+    else if (dir == Direction::DOWN && time > 150 && time < 250)
+    {
+        // High bit: 2 ms
+        val = 1;
+        nominal = 200;
+    }
+    else if (dir == Direction::DOWN && time > 50 && time < 150)
+    {
+        // Low bit: 1 ms
+        val = 0;
+        nominal = 100;
+    }            
+    else if (!(dir == Direction::UP && time > 50 && time < 150) && time < 350)
+    {
+        // Neither a pulse end (1 ms) nor a frame start after a silence
+        statistics.rxInvalidEdges++;
+    }
+    if (histogram != NULL && val >= 0)
+    {
+        histogram->put(int32_t(time - nominal));
+    }
+    return val;
+}
+
+void OnkyoRiInputProcessor::processMsgStart ()
+{
+    if (tick > 0)
+    {
+        statistics.rxIncomplete++;
+    }
+    bits.reset();
+    tick = 0;        
+    command = 0;
+    receiving = true;
+}
+
+bool OnkyoRiInputProcessor::processMsgBit (bool bit)
+{
+    if (tick > 0 && tick <= RI_BITS_COUNT)
+    {
+        bits[RI_BITS_COUNT - tick] = bit;
+    }
+    tick++;
+    if (tick > RI_BITS_COUNT)
+    {
+        tick = 0;
+        command = bits.to_ulong();
+        statistics.rxFrames++;
+        receiving = false;
+    }
+    return command > 0;
+}
+
+bool OnkyoRiInputProcessor::processMsgTimeout ()
+{
+    if (!receiving)
+    {
+        return false;
+    }
+    statistics.rxIncomplete++;
+    bits.reset();
+    tick = 0;
+    command = 0;
+    receiving = false;
+    return true;
+}
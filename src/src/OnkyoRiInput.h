@@ -0,0 +1,152 @@
+/*
+ * onkyoUsbRi: Onkyo RI control
+ * 
+ * Copyright (C) 2021. Mikhail Kulesh
+ *
+ * This program is free software: you can redistribute it and/or modify it under the terms of the GNU
+ * General Public License as published by the Free Software Foundation, either version 3 of the License,
+ * or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without
+ * even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details. You should have received a copy of the GNU General
+ * Public License along with this program.
+ */
+
+#ifndef ONKYO_RI_INPUT_H_
+#define ONKYO_RI_INPUT_H_
+
+#include <bitset>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+namespace StmPlusPlus
+{
+
+/**
+ * @brief Histogram of the deviation of measured pulse durations from the nominal ones.
+ *
+ * Each bin is one timer tick (10 us) wide; deviations outside the range are collected
+ * in the first and the last bins.
+ */
+struct OnkyoRiTimingHistogram
+{
+    static const int32_t BINS_COUNT = 11;
+    static const int32_t BINS_OFFSET = BINS_COUNT / 2;
+    uint16_t bins[BINS_COUNT];
+
+    inline void reset ()
+    {
+        ::memset(bins, 0, sizeof(bins));
+    }
+
+    inline void put (int32_t deviation)
+    {
+        int32_t idx = deviation + BINS_OFFSET;
+        idx = idx < 0 ? 0 : (idx >= BINS_COUNT ? BINS_COUNT - 1 : idx);
+        bins[idx]++;
+    }
+};
+
+/**
+ * @brief Health counters of a RI port.
+ *
+ * Each counter has a single writer (pin interrupt, timer interrupt or main loop), so the
+ * increments are safe without locking. The reset shall be done with disabled interrupts.
+ */
+struct OnkyoRiStatistics
+{
+    // receiver
+    volatile uint32_t rxFrames, rxIncomplete, rxInvalidEdges, rxGlitches;
+    // transmitter
+    volatile uint32_t txFrames, txCollisions, txDropped, txDeferrals, txVerified, txCorrupted;
+
+    inline void reset ()
+    {
+        rxFrames = rxIncomplete = rxInvalidEdges = rxGlitches = 0;
+        txFrames = txCollisions = txDropped = txDeferrals = txVerified = txCorrupted = 0;
+    }
+};
+
+/**
+ * @brief Decoder of the incoming RI frames.
+ *
+ * The decoder does not depend on the HAL, so it can be compiled and measured on the host (see
+ * host/decoderbench.cpp).
+ *
+ * The edge time is measured against a free-running timer (10 us per tick) that is shared
+ * between all RI ports, so the timer is never reset from the pin interrupt.
+ *
+ * Noise rejection: a pulse shorter than the configured minimal width is a glitch. Since it
+ * is detected only at its second edge, each edge is classified immediately but reported with
+ * the next accepted edge. Both edges of a glitch are dropped and the next edge is measured
+ * from the last valid one, so a spike costs neither an event nor the frame in progress.
+ */
+class OnkyoRiInputProcessor
+{
+public:
+    
+    // Default minimal pulse width: 200 us, the shortest valid RI pulse is 1 ms
+    static const uint32_t DEFAULT_MIN_PULSE = 20;
+
+    uint32_t command;
+   
+    OnkyoRiInputProcessor (OnkyoRiStatistics & _statistics);
+    int processPinIrq (bool pinValue, uint32_t now);
+    void processMsgStart ();
+    bool processMsgBit (bool bit);
+
+    /**
+     * @brief Abort the frame in progress, if any.
+     *
+     * @return true if a frame was in progress.
+     */
+    bool processMsgTimeout ();
+
+    inline void setHistogram (OnkyoRiTimingHistogram * _histogram)
+    {
+        histogram = _histogram;
+    }
+
+    inline void setMinPulse (uint32_t _minPulse)
+    {
+        minPulse = _minPulse;
+    }
+
+    inline uint32_t getMinPulse () const
+    {
+        return minPulse;
+    }
+
+    /**
+     * @brief Check whether an edge at the given time closes a glitch: shall be called before processPinIrq().
+     */
+    inline bool isGlitch (uint32_t now) const
+    {
+        return now - lastEdge < minPulse;
+    }
+    
+private:
+    
+    enum Direction
+    {
+        UP = 0,
+        DOWN = 1
+    };
+    
+    static const size_t RI_BITS_COUNT = 12;
+    std::bitset<RI_BITS_COUNT> bits;
+    OnkyoRiStatistics & statistics;
+    uint32_t lastEdge, prevEdge;
+    int pending;
+    volatile uint32_t minPulse;
+    size_t tick;    
+    bool receiving;
+    OnkyoRiTimingHistogram * histogram;
+
+    int classify (bool pinValue, uint32_t time);
+};
+
+} // end namespace
+#endif
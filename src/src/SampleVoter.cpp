@@ -0,0 +1,95 @@
+/*
+ * onkyoUsbRi: Onkyo RI control
+ *
+ * Copyright (C) 2021. Mikhail Kulesh
+ *
+ * This program is free software: you can redistribute it and/or modify it under the terms of the GNU
+ * General Public License as published by the Free Software Foundation, either version 3 of the License,
+ * or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without
+ * even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details. You should have received a copy of the GNU General
+ * Public License along with this program.
+ */
+
+#include "SampleVoter.h"
+
+#ifdef RI_SAMPLED_INPUT
+
+#include <cstring>
+
+using namespace StmPlusPlus;
+
+/************************************************************************
+ * Class SampleVoter
+ ************************************************************************/
+
+SampleVoter::SampleVoter () :
+    handler { NULL },
+    context { NULL },
+    blockTime { 0 },
+    blocks { 0 },
+    votedEdges { 0 },
+    maxBlockEdges { 0 }
+{
+    ::memset(channels, 0, sizeof(channels));
+}
+
+void SampleVoter::setChannel (size_t channel, uint16_t pin)
+{
+    if (channel < CHANNELS_COUNT)
+    {
+        channels[channel].pin = pin;
+    }
+}
+
+void SampleVoter::startVoting (uint32_t levels, uint32_t now)
+{
+    for (Channel & c : channels)
+    {
+        c.level = (levels & c.pin) != 0;
+        c.history = c.level ? (1 << VOTE_SAMPLES) - 1 : 0;
+    }
+    blockTime = now;
+}
+
+void SampleVoter::processBlock (const uint16_t * samples, size_t count)
+{
+    // The voted level changes VOTE_SAMPLES/2 samples after a clean edge
+    const uint32_t delay = (VOTE_SAMPLES / 2) * TICKS_PER_SAMPLE;
+    const uint32_t time = blockTime;
+    uint32_t blockEdges = 0;
+    for (size_t ch = 0; ch < CHANNELS_COUNT; ch++)
+    {
+        Channel & c = channels[ch];
+        if (c.pin == 0)
+        {
+            continue;
+        }
+        uint32_t history = c.history;
+        bool level = c.level;
+        for (size_t i = 0; i < count; i++)
+        {
+            history = ((history << 1) | ((samples[i] & c.pin) != 0)) & ((1 << VOTE_SAMPLES) - 1);
+            const bool vote = uint32_t(__builtin_popcount(history)) > VOTE_SAMPLES / 2;
+            if (vote != level)
+            {
+                level = vote;
+                blockEdges++;
+                if (handler != NULL)
+                {
+                    handler(context, uint8_t(ch), level, time + i * TICKS_PER_SAMPLE - delay);
+                }
+            }
+        }
+        c.history = history;
+        c.level = level;
+    }
+    blockTime = time + count * TICKS_PER_SAMPLE;
+    blocks = blocks + 1;
+    votedEdges = votedEdges + blockEdges;
+    maxBlockEdges = blockEdges > maxBlockEdges ? blockEdges : maxBlockEdges;
+}
+
+#endif
@@ -0,0 +1,126 @@
+/*
+ * onkyoUsbRi: Onkyo RI control
+ *
+ * Copyright (C) 2021. Mikhail Kulesh
+ *
+ * This program is free software: you can redistribute it and/or modify it under the terms of the GNU
+ * General Public License as published by the Free Software Foundation, either version 3 of the License,
+ * or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without
+ * even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details. You should have received a copy of the GNU General
+ * Public License along with this program.
+ */
+
+#ifndef SAMPLE_VOTER_H_
+#define SAMPLE_VOTER_H_
+
+#include <cstddef>
+#include <cstdint>
+
+#ifdef RI_SAMPLED_INPUT
+
+namespace StmPlusPlus
+{
+
+/**
+ * @brief Decoder of the sampled RI lines into edges.
+ *
+ * Each sample holds the levels of all lines of one GPIO port. For each line, the level is the
+ * majority of the last VOTE_SAMPLES samples, and a change of the voted level ends a run of samples.
+ * The run ends are converted into edges with the time of the RX timer and passed to the edge handler
+ * one by one, so a noisy block cannot overflow an intermediate queue.
+ *
+ * The voter does not depend on the HAL: SampledInput feeds it from the DMA buffer on the target,
+ * host/decoderbench.cpp from generated traces.
+ */
+class SampleVoter
+{
+public:
+
+    static const size_t CHANNELS_COUNT = 4;
+    static const uint32_t TICKS_PER_SAMPLE = 2; // ticks of 10 us: 50 kHz
+    static const uint32_t VOTE_SAMPLES = 5; // the level needs 3 of the last 5 samples: 60 us
+
+    /**
+     * @brief Handler of an edge of the voted level of a line: time is the RX timer value of the
+     * estimated edge. Called from the DMA interrupt.
+     */
+    typedef void (*EdgeHandler) (void * context, uint8_t channel, bool level, uint32_t time);
+
+    SampleVoter ();
+
+    inline void setEdgeHandler (EdgeHandler _handler, void * _context)
+    {
+        handler = _handler;
+        context = _context;
+    }
+
+    /**
+     * @brief Decode the given pin as the line of the given channel.
+     */
+    void setChannel (size_t channel, uint16_t pin);
+
+    /**
+     * @brief Start with the given levels of the idle lines at the given RX timer value.
+     */
+    void startVoting (uint32_t levels, uint32_t now);
+
+    /**
+     * @brief Decode the given samples into edges.
+     */
+    void processBlock (const uint16_t * samples, size_t count);
+
+    /**
+     * @brief RX timer value up to which all clean edges have been delivered.
+     */
+    inline uint32_t getInputTime () const
+    {
+        return blockTime - (VOTE_SAMPLES / 2 + 1) * TICKS_PER_SAMPLE;
+    }
+
+    inline uint32_t getBlocks () const
+    {
+        return blocks;
+    }
+
+    inline uint32_t getVotedEdges () const
+    {
+        return votedEdges;
+    }
+
+    /**
+     * @brief Most voted edges of all lines in one block.
+     */
+    inline uint32_t getMaxBlockEdges () const
+    {
+        return maxBlockEdges;
+    }
+
+    inline void resetMaxBlockEdges ()
+    {
+        maxBlockEdges = 0;
+    }
+
+private:
+
+    struct Channel
+    {
+        uint16_t pin;
+        uint8_t history; // last samples, the newest one in the bit 0
+        bool level;
+    };
+
+    EdgeHandler handler;
+    void * context;
+    Channel channels[CHANNELS_COUNT];
+
+    // RX timer value of the first sample of the next block
+    volatile uint32_t blockTime;
+    volatile uint32_t blocks, votedEdges, maxBlockEdges;
+};
+
+} // end namespace
+#endif
+#endif
@@ -0,0 +1,80 @@
+/*
+ * onkyoUsbRi: Onkyo RI control
+ *
+ * Copyright (C) 2021. Mikhail Kulesh
+ *
+ * This program is free software: you can redistribute it and/or modify it under the terms of the GNU
+ * General Public License as published by the Free Software Foundation, either version 3 of the License,
+ * or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without
+ * even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details. You should have received a copy of the GNU General
+ * Public License along with this program.
+ */
+
+#include "SampledInput.h"
+
+#ifdef RI_SAMPLED_INPUT
+
+using namespace StmPlusPlus;
+
+/************************************************************************
+ * Class SampledInput
+ ************************************************************************/
+
+SampledInput::SampledInput (IOPort::PortName name, TimerBase & _timer) :
+    inputs { name, GPIO_MODE_INPUT, GPIO_NOPULL, GPIO_SPEED_HIGH, GPIO_PIN_All, false },
+    timer { _timer }
+{
+    // TIM16_UP requests the DMA1 channel 3 unless remapped
+    dmaParams.Instance = DMA1_Channel3;
+    dmaParams.Parent = this;
+}
+
+bool SampledInput::start (const InterruptPriority & prio, uint32_t now)
+{
+    // The lines are idle: start with the current levels
+    startVoting(inputs.getInt(), now);
+
+    __HAL_RCC_DMA1_CLK_ENABLE();
+    dmaParams.Init.Direction = DMA_PERIPH_TO_MEMORY;
+    dmaParams.Init.PeriphInc = DMA_PINC_DISABLE;
+    dmaParams.Init.MemInc = DMA_MINC_ENABLE;
+    dmaParams.Init.PeriphDataAlignment = DMA_PDATAALIGN_HALFWORD;
+    dmaParams.Init.MemDataAlignment = DMA_MDATAALIGN_HALFWORD;
+    dmaParams.Init.Mode = DMA_CIRCULAR;
+    dmaParams.Init.Priority = DMA_PRIORITY_HIGH;
+    if (HAL_DMA_Init(&dmaParams) != HAL_OK)
+    {
+        return false;
+    }
+    dmaParams.XferHalfCpltCallback = onHalfTransfer;
+    dmaParams.XferCpltCallback = onTransfer;
+    HAL_NVIC_SetPriority(DMA1_Channel3_IRQn, prio.first, prio.second);
+    HAL_NVIC_EnableIRQ(DMA1_Channel3_IRQn);
+    if (HAL_DMA_Start_IT(&dmaParams, (uint32_t) inputs.getInputRegister(), (uint32_t) buffer,
+                         2 * BLOCK_SAMPLES) != HAL_OK)
+    {
+        return false;
+    }
+
+    // Same prescaler as the RX timer: one sample per TICKS_PER_SAMPLE ticks
+    __HAL_TIM_ENABLE_DMA(timer.getTimerParameters(), TIM_DMA_UPDATE);
+    return timer.startCounter(TIM_COUNTERMODE_UP, System::getMcuFreq()/100000, TICKS_PER_SAMPLE - 1,
+                              TIM_CLOCKDIVISION_DIV1) == HAL_OK;
+}
+
+void SampledInput::onHalfTransfer (DMA_HandleTypeDef * hdma)
+{
+    SampledInput * input = (SampledInput *) hdma->Parent;
+    input->processBlock(input->buffer, BLOCK_SAMPLES);
+}
+
+void SampledInput::onTransfer (DMA_HandleTypeDef * hdma)
+{
+    SampledInput * input = (SampledInput *) hdma->Parent;
+    input->processBlock(input->buffer + BLOCK_SAMPLES, BLOCK_SAMPLES);
+}
+
+#endif
@@ -0,0 +1,74 @@
+/*
+ * onkyoUsbRi: Onkyo RI control
+ *
+ * Copyright (C) 2021. Mikhail Kulesh
+ *
+ * This program is free software: you can redistribute it and/or modify it under the terms of the GNU
+ * General Public License as published by the Free Software Foundation, either version 3 of the License,
+ * or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without
+ * even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details. You should have received a copy of the GNU General
+ * Public License along with this program.
+ */
+
+#ifndef SAMPLED_INPUT_H_
+#define SAMPLED_INPUT_H_
+
+#include "BasicIO.h"
+#include "SampleVoter.h"
+
+#ifdef RI_SAMPLED_INPUT
+
+namespace StmPlusPlus
+{
+
+/**
+ * @brief Oversampled input of the RI lines connected to one GPIO port.
+ *
+ * Each update event of a sampling timer (50 kHz) requests a DMA transfer of the input data register
+ * of the port into a circular buffer, so all lines are sampled at once without any CPU load. Each
+ * completed half of the buffer is decoded by the SampleVoter in the DMA interrupt, so the edges are
+ * passed to the handler still in the DMA interrupt. The RI ports classify the run lengths as for the
+ * edge interrupts.
+ *
+ * In contrast to the edge interrupts, the decoding time only depends on the number of samples and
+ * lines: noise on the line neither adds interrupts nor can it starve the main loop. Spikes shorter
+ * than the half of the vote window do not reach the ports at all.
+ */
+class SampledInput : public SampleVoter
+{
+public:
+
+    static const size_t BLOCK_SAMPLES = 64; // samples in each half of the buffer: 1.28 ms
+
+    SampledInput (IOPort::PortName name, TimerBase & _timer);
+
+    /**
+     * @brief Start the sampling, the edge times continue the given RX timer value.
+     */
+    bool start (const InterruptPriority & prio, uint32_t now);
+
+    /**
+     * @brief Handle the DMA interrupt: the completed half of the buffer is decoded into edges.
+     */
+    inline void processDmaInterrupt ()
+    {
+        HAL_DMA_IRQHandler(&dmaParams);
+    }
+
+private:
+
+    IOPort inputs;
+    TimerBase & timer;
+    DMA_HandleTypeDef dmaParams;
+    uint16_t buffer[2 * BLOCK_SAMPLES];
+
+    static void onHalfTransfer (DMA_HandleTypeDef * hdma);
+    static void onTransfer (DMA_HandleTypeDef * hdma);
+};
+
+} // end namespace
+#endif
+#endif
@@ -0,0 +1,142 @@
+/*
+ * onkyoUsbRi: Onkyo RI control
+ * 
+ * Copyright (C) 2021. Mikhail Kulesh
+ *
+ * This program is free software: you can redistribute it and/or modify it under the terms of the GNU
+ * General Public License as published by the Free Software Foundation, either version 3 of the License,
+ * or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without
+ * even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details. You should have received a copy of the GNU General
+ * Public License along with this program.
+ */
+
+#include "SelfTest.h"
+
+using namespace StmPlusPlus;
+
+#define USART_DEBUG_MODULE "SELFTEST: "
+#define USART_DEBUG_MODULE_ID 2
+
+/************************************************************************
+ * Class OnkyoRiSelfTest
+ ************************************************************************/
+
+OnkyoRiSelfTest::OnkyoRiSelfTest () :
+    port { NULL },
+    framesCount { 0 },
+    sentFrames { 0 },
+    receivedFrames { 0 },
+    errorFrames { 0 },
+    bitErrors { 0 },
+    expected { 0 },
+    random { 0 },
+    glitches { 0 },
+    startTime { 0 },
+    nextFrameTime { 0 }
+{
+    histogram.reset();
+}
+
+void OnkyoRiSelfTest::start (OnkyoRiPort & _port, uint32_t frames)
+{
+    if (port != NULL)
+    {
+        return;
+    }
+    port = &_port;
+    framesCount = frames > 0 ? frames : DEFAULT_FRAMES;
+    sentFrames = receivedFrames = errorFrames = bitErrors = 0;
+    expected = 0;
+    // fixed seed: the same code sequence for each test run
+    random = 0x2545F491;
+    histogram.reset();
+    glitches = port->statistics.rxGlitches;
+    port->inputProcessor.setHistogram(&histogram);
+    startTime = nextFrameTime = HAL_GetTick();
+    USART_DEBUG("started on RI" << int(port->id) << ", frames: " << framesCount << UsartLogger::ENDL);
+}
+
+void OnkyoRiSelfTest::processTick ()
+{
+    if (port == NULL || port->outputProcessor.isBusy())
+    {
+        return;
+    }
+    uint32_t now = HAL_GetTick();
+    if (int32_t(now - nextFrameTime) < 0)
+    {
+        return;
+    }
+    if (sentFrames < framesCount)
+    {
+        expected = nextCode();
+        port->outputProcessor.send(expected);
+        sentFrames++;
+        nextFrameTime = now + FRAME_PERIOD;
+    }
+    else
+    {
+        finish();
+    }
+}
+
+void OnkyoRiSelfTest::processFrame (const OnkyoRiPort & _port, uint32_t code)
+{
+    if (port != &_port)
+    {
+        return;
+    }
+    receivedFrames++;
+    if (code != expected)
+    {
+        errorFrames++;
+        bitErrors += __builtin_popcount((code ^ expected) & RI_CODE_MASK);
+    }
+}
+
+uint32_t OnkyoRiSelfTest::nextCode ()
+{
+    // xorshift32; code 0 is skipped since it is not reported by the decoder
+    uint32_t code = 0;
+    while (code == 0)
+    {
+        random ^= random << 13;
+        random ^= random >> 17;
+        random ^= random << 5;
+        code = random & RI_CODE_MASK;
+    }
+    return code;
+}
+
+void OnkyoRiSelfTest::finish ()
+{
+    const uint32_t elapsed = HAL_GetTick() - startTime;
+    const uint32_t bits = receivedFrames * 12;
+    const uint32_t ber = bits > 0 ? uint32_t((uint64_t(bitErrors) * 1000000) / bits) : 0;
+    const uint32_t fps = elapsed > 0 ? (receivedFrames * 10000) / elapsed : 0;
+
+    port->inputProcessor.setHistogram(NULL);
+
+    USART_REPORT("sent " << sentFrames << ", received " << receivedFrames
+                 << ", corrupted " << errorFrames << ", lost " << int(sentFrames - receivedFrames)
+                 << UsartLogger::ENDL);
+    USART_REPORT("frames/s " << int(fps / 10) << "." << int(fps % 10)
+                 << ", bit errors " << bitErrors << "/" << bits << " (" << ber << " ppm)"
+                 << ", glitches " << int(port->statistics.rxGlitches - glitches) << UsartLogger::ENDL);
+    if (IS_USART_DEBUG_ACTIVE())
+    {
+        UsartLogger & log = UsartLogger::getStream();
+        log << USART_DEBUG_MODULE << "timing [" << -10 * OnkyoRiTimingHistogram::BINS_OFFSET << ".."
+            << 10 * OnkyoRiTimingHistogram::BINS_OFFSET << " us]:";
+        for (int32_t i = 0; i < OnkyoRiTimingHistogram::BINS_COUNT; i++)
+        {
+            log << " " << histogram.bins[i];
+        }
+        log << UsartLogger::ENDL;
+    }
+    USART_REPORT((receivedFrames == sentFrames && errorFrames == 0 ? "PASSED" : "FAILED") << UsartLogger::ENDL);
+    port = NULL;
+}
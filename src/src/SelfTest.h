@@ -0,0 +1,70 @@
+/*
+ * onkyoUsbRi: Onkyo RI control
+ * 
+ * Copyright (C) 2021. Mikhail Kulesh
+ *
+ * This program is free software: you can redistribute it and/or modify it under the terms of the GNU
+ * General Public License as published by the Free Software Foundation, either version 3 of the License,
+ * or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without
+ * even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details. You should have received a copy of the GNU General
+ * Public License along with this program.
+ */
+
+#ifndef SELF_TEST_H_
+#define SELF_TEST_H_
+
+#include "OnkyoRi.h"
+
+namespace StmPlusPlus
+{
+
+/**
+ * @brief Loopback self-test of a RI port.
+ *
+ * The port output is looped into its input (the adapter receives its own frames on the
+ * shared RI line, or via a jumper). Pseudo-random 12-bit codes are sent with the maximum
+ * rate allowed by the RI protocol and compared with the decoded ones. At the end, frame
+ * rate, bit error rate and the timing histogram of the decoded pulses are reported.
+ */
+class OnkyoRiSelfTest
+{
+public:
+
+    // Constant frame length of the RI protocol (header, 12 bits, trailer and gap), ms
+    static const uint32_t FRAME_PERIOD = 67;
+    static const uint32_t DEFAULT_FRAMES = 100;
+
+    OnkyoRiSelfTest ();
+    void start (OnkyoRiPort & _port, uint32_t frames);
+    void processTick ();
+    void processFrame (const OnkyoRiPort & _port, uint32_t code);
+
+    inline bool isActive () const
+    {
+        return port != NULL;
+    }
+
+    inline bool isActive (const OnkyoRiPort & _port) const
+    {
+        return port == &_port;
+    }
+
+private:
+
+    static const uint32_t RI_CODE_MASK = 0xFFF;
+
+    OnkyoRiPort * port;
+    uint32_t framesCount, sentFrames, receivedFrames, errorFrames, bitErrors;
+    uint32_t expected, random, glitches;
+    uint32_t startTime, nextFrameTime;
+    OnkyoRiTimingHistogram histogram;
+
+    uint32_t nextCode ();
+    void finish ();
+};
+
+} // end namespace
+#endif
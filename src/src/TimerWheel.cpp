@@ -0,0 +1,173 @@
+/*
+ * onkyoUsbRi: Onkyo RI control
+ * 
+ * Copyright (C) 2021. Mikhail Kulesh
+ *
+ * This program is free software: you can redistribute it and/or modify it under the terms of the GNU
+ * General Public License as published by the Free Software Foundation, either version 3 of the License,
+ * or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without
+ * even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details. You should have received a copy of the GNU General
+ * Public License along with this program.
+ */
+
+#include "TimerWheel.h"
+
+using namespace StmPlusPlus;
+
+/************************************************************************
+ * Class TimerWheel
+ ************************************************************************/
+
+TimerWheel::TimerWheel () :
+    freeList { 0 },
+    current { 0 },
+    started { false },
+    active { 0 },
+    highWater { 0 }
+{
+    for (size_t i = 0; i < POOL_SIZE; i++)
+    {
+        pool[i].next = i + 1 < POOL_SIZE ? i + 1 : NONE;
+        pool[i].prev = NONE;
+        pool[i].slot = NONE;
+        pool[i].generation = 0;
+    }
+    ::memset(heads, NONE, sizeof(heads));
+}
+
+TimerWheel::Handle TimerWheel::start (uint32_t now, uint32_t delay, Callback callback, void * context, uint32_t arg)
+{
+    if (freeList == NONE)
+    {
+        return NO_TIMER;
+    }
+    if (!started)
+    {
+        current = now;
+        started = true;
+    }
+    const uint8_t t = freeList;
+    freeList = pool[t].next;
+
+    // The wheel may lag behind the given time until the next process() call
+    pool[t].expiry = now + (delay > 0 ? delay : 1);
+    if (int32_t(pool[t].expiry - current) <= 0)
+    {
+        pool[t].expiry = current + 1;
+    }
+    pool[t].callback = callback;
+    pool[t].context = context;
+    pool[t].arg = arg;
+    insert(t);
+
+    active++;
+    highWater = active > highWater ? active : highWater;
+    return getHandle(t);
+}
+
+void TimerWheel::cancel (Handle & handle)
+{
+    if (isRunning(handle))
+    {
+        const uint8_t t = handle & 0xFF;
+        unlink(t);
+        pool[t].generation++;
+        pool[t].next = freeList;
+        freeList = t;
+        active--;
+    }
+    handle = NO_TIMER;
+}
+
+bool TimerWheel::isRunning (Handle handle) const
+{
+    const uint8_t t = handle & 0xFF;
+    return handle != NO_TIMER && t < POOL_SIZE && pool[t].slot != NONE && getHandle(t) == handle;
+}
+
+void TimerWheel::process (uint32_t now)
+{
+    if (!started)
+    {
+        current = now;
+        started = true;
+        return;
+    }
+    while (int32_t(now - current) > 0)
+    {
+        current++;
+
+        // Move the timers of the next 64 ms from the second level into the first one
+        if ((current & SLOTS_MASK) == 0)
+        {
+            uint8_t t = heads[SLOTS_COUNT + ((current >> SLOTS_BITS) & SLOTS_MASK)];
+            while (t != NONE)
+            {
+                const uint8_t next = pool[t].next;
+                unlink(t);
+                insert(t);
+                t = next;
+            }
+        }
+
+        const uint8_t slot = current & SLOTS_MASK;
+        while (heads[slot] != NONE)
+        {
+            const uint8_t t = heads[slot];
+            unlink(t);
+            pool[t].generation++;
+            pool[t].next = freeList;
+            freeList = t;
+            active--;
+            // The timer is already free: the callback may start it again
+            pool[t].callback(pool[t].context, pool[t].arg);
+        }
+    }
+}
+
+void TimerWheel::insert (uint8_t t)
+{
+    const uint32_t expiry = pool[t].expiry;
+    size_t slot;
+    if (expiry - current < SLOTS_COUNT)
+    {
+        slot = expiry & SLOTS_MASK;
+    }
+    else if ((expiry >> SLOTS_BITS) - (current >> SLOTS_BITS) < SLOTS_COUNT)
+    {
+        slot = SLOTS_COUNT + ((expiry >> SLOTS_BITS) & SLOTS_MASK);
+    }
+    else
+    {
+        // Beyond the second level: park in its last slot and move again from there
+        slot = SLOTS_COUNT + (((current >> SLOTS_BITS) + SLOTS_MASK) & SLOTS_MASK);
+    }
+    pool[t].slot = slot;
+    pool[t].prev = NONE;
+    pool[t].next = heads[slot];
+    if (heads[slot] != NONE)
+    {
+        pool[heads[slot]].prev = t;
+    }
+    heads[slot] = t;
+}
+
+void TimerWheel::unlink (uint8_t t)
+{
+    if (pool[t].prev != NONE)
+    {
+        pool[pool[t].prev].next = pool[t].next;
+    }
+    else
+    {
+        heads[pool[t].slot] = pool[t].next;
+    }
+    if (pool[t].next != NONE)
+    {
+        pool[pool[t].next].prev = pool[t].prev;
+    }
+    pool[t].slot = NONE;
+}
@@ -0,0 +1,110 @@
+/*
+ * onkyoUsbRi: Onkyo RI control
+ * 
+ * Copyright (C) 2021. Mikhail Kulesh
+ *
+ * This program is free software: you can redistribute it and/or modify it under the terms of the GNU
+ * General Public License as published by the Free Software Foundation, either version 3 of the License,
+ * or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without
+ * even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details. You should have received a copy of the GNU General
+ * Public License along with this program.
+ */
+
+#ifndef TIMER_WHEEL_H_
+#define TIMER_WHEEL_H_
+
+#include "BasicIO.h"
+
+namespace StmPlusPlus
+{
+
+/**
+ * @brief Software timers with a resolution of 1 ms.
+ *
+ * The timers are taken from a fixed pool and kept in a hierarchical wheel: the first level has
+ * a slot per millisecond, the second level a slot per 64 ms. Timers of the second level are moved
+ * into the first one when their slot comes due, timers beyond the second level are moved
+ * through its last slot until they fit. Start and cancel are O(1).
+ *
+ * The time base is the SysTick counter: process() shall be called from the main loop with
+ * HAL_GetTick(), so the callbacks are executed in the main loop context.
+ */
+class TimerWheel
+{
+public:
+
+    typedef void (*Callback) (void * context, uint32_t arg);
+
+    // A handle contains the pool index and a generation: a handle of an expired timer is never valid
+    typedef uint16_t Handle;
+    static const Handle NO_TIMER = 0xFFFF;
+
+    static const size_t POOL_SIZE = 16;
+
+    TimerWheel ();
+
+    /**
+     * @brief Call the given callback after delay ms (at least 1 ms).
+     *
+     * @return the handle of the timer or NO_TIMER if the pool is exhausted.
+     */
+    Handle start (uint32_t now, uint32_t delay, Callback callback, void * context, uint32_t arg);
+
+    /**
+     * @brief Cancel the timer if it is still running and set the handle to NO_TIMER.
+     */
+    void cancel (Handle & handle);
+
+    bool isRunning (Handle handle) const;
+
+    void process (uint32_t now);
+
+    inline size_t getActive () const
+    {
+        return active;
+    }
+
+    inline size_t getHighWater () const
+    {
+        return highWater;
+    }
+
+private:
+
+    static const size_t SLOTS_BITS = 6;
+    static const size_t SLOTS_COUNT = 1 << SLOTS_BITS;
+    static const size_t SLOTS_MASK = SLOTS_COUNT - 1;
+    static const uint8_t NONE = 0xFF;
+
+    struct Timer
+    {
+        uint32_t expiry;
+        Callback callback;
+        void * context;
+        uint32_t arg;
+        uint8_t next, prev;
+        uint8_t slot;        // index in heads, NONE if the timer is free
+        uint8_t generation;
+    };
+
+    Timer pool[POOL_SIZE];
+    uint8_t heads[2 * SLOTS_COUNT];
+    uint8_t freeList;
+    uint32_t current;
+    bool started;
+    size_t active, highWater;
+
+    void insert (uint8_t t);
+    void unlink (uint8_t t);
+
+    inline Handle getHandle (uint8_t t) const
+    {
+        return (uint16_t(pool[t].generation) << 8) | t;
+    }
+};
+
+} // end namespace
+#endif
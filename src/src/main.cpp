@@ -14,36 +14,185 @@
  */
 
 #include "OnkyoRi.h"
+#include "HostCommand.h"
+#include "SelfTest.h"
+#include "EdgeCapture.h"
+#include "CrashDump.h"
+#include "TimerWheel.h"
 #include "EventQueue.h"
+#include "AnalogFrontEnd.h"
+#include "LineMonitor.h"
+#include "SampledInput.h"
 
 using namespace StmPlusPlus;
 
 #define USART_DEBUG_MODULE ""
+#define USART_DEBUG_MODULE_ID 1
+
+// Number of used RI ports: can be overwritten by the build settings
+#ifndef RI_PORTS_COUNT
+#define RI_PORTS_COUNT 1
+#endif
+
+// Hardware flow control of the host link: 0 - none, 1 - RTS (PA12) throttles the host,
+// 2 - RTS and CTS (PA11), the adapter output also waits for the host
+#ifndef USART_FLOW_CONTROL
+#define USART_FLOW_CONTROL 0
+#endif
+
+static const size_t RI_PORTS_MAX = 4;
+static const uint32_t WATCHDOG_TIMEOUT = 250; // ms
+static const uint32_t LED_BLINK_TIME = 100; // ms
+static const uint32_t RX_FRAME_TIMEOUT = 60; // ms, a frame takes at most 40 ms
+static const uint32_t LINE_MONITOR_WINDOW = 256; // ms
+
+// With the build setting RI_ANALOG_INPUT, the input of the port 0 is the comparator on PA7 instead of EXTI
+#ifdef RI_ANALOG_INPUT
+static const size_t ANALOG_INPUT_PORTS = 1;
+#else
+static const size_t ANALOG_INPUT_PORTS = 0;
+#endif
+
+// With the build setting RI_SAMPLED_INPUT, the other inputs (all on the port B) are sampled by DMA
+// and decoded in batches instead of the EXTI interrupts
+static_assert(RI_PORTS_COUNT >= 1 && RI_PORTS_COUNT <= RI_PORTS_MAX, "Unsupported number of RI ports");
+
+// Each port uses an own EXTI line for the input and an own TX timer channel for the output
+static const OnkyoRiPort::Config RI_PORTS[RI_PORTS_MAX] = {
+    { IOPort::B, GPIO_PIN_1, EXTI1_IRQn,   IOPort::A, GPIO_PIN_3, TIM_CHANNEL_1 },
+    { IOPort::B, GPIO_PIN_0, EXTI0_IRQn,   IOPort::A, GPIO_PIN_4, TIM_CHANNEL_2 },
+    { IOPort::B, GPIO_PIN_4, EXTI4_IRQn,   IOPort::A, GPIO_PIN_5, TIM_CHANNEL_3 },
+    { IOPort::B, GPIO_PIN_5, EXTI9_5_IRQn, IOPort::A, GPIO_PIN_6, TIM_CHANNEL_4 }
+};
 
 class MyApplication
 {
 private:
     UsartLogger usart;
     IOPin riLed, mco;
+    IndependentWatchdog watchdog;
     
-    // RI input pin and interrupt
-    static const uint16_t RI_INPUT_PIN = GPIO_PIN_1;    
-    static const IRQn_Type RI_INPUT_IRQN = EXTI1_IRQn;
-    IOPin riInput, riOutput;
-    
-    // RI command processing
-    OnkyoRiInputProcessor inputProcessor;
-    OnkyoRiOutputProcessor outputProcessor;
+    // Free-running timers shared between all RI ports: 10 us per tick
+    TimerBase rxTimer, txTimer;
+
+    // Trigger of the line monitor conversions
+    TimerBase monitorTimer;
+
+    #ifdef RI_SAMPLED_INPUT
+    // Sampling of the RI inputs
+    TimerBase samplerTimer;
+    SampledInput sampler;
+    #endif
+
+    // Learned raw frames
+    OnkyoRiFrameStore frameStore;
+
+    // RI ports
+    OnkyoRiPort ports[RI_PORTS_MAX];
+    #ifdef RI_ANALOG_INPUT
+    AnalogFrontEnd frontEnd;
+    #endif
+
+    // RI line level and supply voltage
+    LineMonitor monitor;
+
+    // Host command processing
+    HostCommand hostCommand;
+
+    // Loopback self-test
+    OnkyoRiSelfTest selfTest;
+
+    // Raw edge capture
+    EdgeCapture capture;
 
     // Event processing
-    enum class Event
+    enum class EventType : uint8_t
     {
         RI_CMD_LOW = 0,
         RI_CMD_HIGH = 1,
         RI_CMD_START = 2,
-        USART_INPUT = 3
+        USART_INPUT = 3,
+        RI_TX_DONE = 4,
+        USART_ERROR = 5
+    };
+
+    // The producer hands all data over in the event: the main loop does not read fields of the
+    // interrupt handlers that could change until the event is processed
+    union EventPayload
+    {
+        uint32_t error; // USART_ERROR: HAL error code
+        HostCommand::Command command; // USART_INPUT
+
+        EventPayload (uint32_t value = 0) :
+            error { value }
+        {
+            // empty
+        }
+
+        EventPayload (const HostCommand::Command & _command) :
+            command (_command)
+        {
+            // empty
+        }
+    };
+
+    struct Event
+    {
+        EventType type;
+        uint8_t port;
+        uint16_t time; // lower bits of the RX timer when the event was posted
+        EventPayload payload;
+    };
+
+    // Each priority class has an own queue; per main loop iteration, the classes are served in this
+    // order with a bounded number of events: RI input, RI output, host commands. Diagnostics
+    // (self-test, learning, capture) run after them.
+    static const size_t RX_EVENTS_PER_LOOP = 16;
+    static const size_t TX_EVENTS_PER_LOOP = 4;
+    static const size_t HOST_EVENTS_PER_LOOP = 1;
+
+    struct EventLatency
+    {
+        uint32_t events;
+        uint32_t maxLatency; // in ticks of 10 us
+    };
+
+    StmPlusPlus::EventQueue<Event, 64> rxEvents;
+    StmPlusPlus::EventQueue<Event, 8> txEvents, hostEvents;
+    EventLatency rxLatency, txLatency, hostLatency;
+
+    // Deferred actions
+    enum class TimerId : uint8_t
+    {
+        LED_OFF = 0,
+        RX_TIMEOUT = 1,
+        LINE_MONITOR = 2
+    };
+
+    TimerWheel timers;
+    TimerWheel::Handle ledTimer;
+    TimerWheel::Handle rxTimeouts[RI_PORTS_MAX];
+
+    // Host command acknowledgements
+    enum class AckStatus : uint8_t
+    {
+        QUEUED = 0,
+        DONE = 1,
+        REJECTED = 2,
+        DROPPED = 3
     };
-    StmPlusPlus::EventQueue<Event, 100> eventQueue;
+
+    int32_t nextSequence;
+
+    // Host command waiting for space in the TX queue while the reception is stopped
+    HostCommand::Command stalledCommand;
+    int32_t stalledSequence;
+    bool hostStalled;
+
+    // Host interface counters
+    uint32_t usartCommands, usartInvalidCommands;
+    volatile uint32_t usartErrors;
+    uint32_t usartStalls;
 
 public:
     
@@ -51,11 +200,42 @@ public:
         usart(Usart::USART_1, IOPort::B, GPIO_PIN_6, GPIO_PIN_7, GPIO_SPEED_HIGH, 115200),
         riLed(IOPort::A, GPIO_PIN_2, GPIO_MODE_OUTPUT_PP),
         mco(IOPort::A, GPIO_PIN_8, GPIO_MODE_AF_PP),
-        riInput(IOPort::B, RI_INPUT_PIN, GPIO_MODE_IT_RISING_FALLING),
-        riOutput(IOPort::A, GPIO_PIN_3, GPIO_MODE_OUTPUT_PP, GPIO_NOPULL),
-        inputProcessor(TimerBase::TIM_2),
-        outputProcessor(riOutput, TimerBase::TIM_3)
+        rxTimer(TimerBase::TIM_2),
+        txTimer(TimerBase::TIM_3),
+        monitorTimer(TimerBase::TIM_6),
+        #ifdef RI_SAMPLED_INPUT
+        samplerTimer(TimerBase::TIM_16),
+        sampler(IOPort::B, samplerTimer),
+        #endif
+        ports {
+            { 0, RI_PORTS[0], 0 < RI_PORTS_COUNT, rxTimer, txTimer, frameStore },
+            { 1, RI_PORTS[1], 1 < RI_PORTS_COUNT, rxTimer, txTimer, frameStore },
+            { 2, RI_PORTS[2], 2 < RI_PORTS_COUNT, rxTimer, txTimer, frameStore },
+            { 3, RI_PORTS[3], 3 < RI_PORTS_COUNT, rxTimer, txTimer, frameStore }
+        },
+        #ifdef RI_ANALOG_INPUT
+        frontEnd(rxTimer),
+        #endif
+        monitor(monitorTimer),
+        rxLatency { 0, 0 },
+        txLatency { 0, 0 },
+        hostLatency { 0, 0 },
+        ledTimer(TimerWheel::NO_TIMER),
+        rxTimeouts { TimerWheel::NO_TIMER, TimerWheel::NO_TIMER, TimerWheel::NO_TIMER, TimerWheel::NO_TIMER },
+        nextSequence(OnkyoRiPort::NO_SEQUENCE),
+        stalledCommand { HostCommand::State::INCOMPLETE, 0, 0 },
+        stalledSequence(OnkyoRiPort::NO_SEQUENCE),
+        hostStalled(false),
+        usartCommands(0),
+        usartInvalidCommands(0),
+        usartErrors(0),
+        usartStalls(0)
     {
+        #if USART_FLOW_CONTROL == 1
+        usart.setFlowControl(UART_HWCONTROL_RTS, IOPort::A, GPIO_PIN_12);
+        #elif USART_FLOW_CONTROL == 2
+        usart.setFlowControl(UART_HWCONTROL_RTS_CTS, IOPort::A, GPIO_PIN_11 | GPIO_PIN_12);
+        #endif
         mco.activateClockOutput(RCC_MCO1SOURCE_PLLCLK, RCC_MCODIV_2);
     }
     
@@ -67,79 +247,691 @@ public:
     void run ()
     {
         usart.initInstance();
-       
+        InterruptLock::startMeasurement();
         riLed.setHigh();
-        USART_DEBUG("--------------------------------------------------------" << UsartLogger::ENDL);
-        USART_DEBUG("MCU frequency: " << System::getMcuFreq() << UsartLogger::ENDL);
-        riLed.setLow();
+        const bool framesLoaded = frameStore.load();
         
-        // Activate interrupts for RI input
-        HAL_NVIC_SetPriority(RI_INPUT_IRQN, 1, 0);
-        HAL_NVIC_EnableIRQ(RI_INPUT_IRQN);
+        // Start shared timers: TIM2 is a 32-bit timer, TIM3 is a 16-bit timer
+        rxTimer.startCounter(TIM_COUNTERMODE_UP, System::getMcuFreq()/100000, 0xFFFFFFFF, TIM_CLOCKDIVISION_DIV1);
+        txTimer.startCounter(TIM_COUNTERMODE_UP, System::getMcuFreq()/100000, 0xFFFF, TIM_CLOCKDIVISION_DIV1);
+        // The TX timer has the highest priority: it is never masked by the InterruptLock of a lower level
+        HAL_NVIC_SetPriority(TIM3_IRQn, 0, 0);
+        HAL_NVIC_EnableIRQ(TIM3_IRQn);
+
+        // Activate interrupts for RI inputs
+        #ifdef RI_SAMPLED_INPUT
+        // The DMA interrupt has the priority of the edge interrupts, so it never preempts the analog input
+        for (size_t i = ANALOG_INPUT_PORTS; i < RI_PORTS_COUNT; i++)
+        {
+            sampler.setChannel(i, RI_PORTS[i].inPin);
+        }
+        sampler.setEdgeHandler(onSampledEdge, this);
+        const bool samplerStarted = sampler.start(InterruptPriority(1, 0), rxTimer.getValue());
+        #else
+        for (size_t i = ANALOG_INPUT_PORTS; i < RI_PORTS_COUNT; i++)
+        {
+            ports[i].startInterrupt(InterruptPriority(1, 0));
+        }
+        #endif
+        #ifdef RI_ANALOG_INPUT
+        const bool frontEndStarted = frontEnd.start(InterruptPriority(1, 0));
+        #endif
+
+        // Continuous line and supply monitoring: the DMA interrupt has the lowest priority
+        const bool monitorStarted = monitor.start(InterruptPriority(3, 0));
+        startTimer(LINE_MONITOR_WINDOW, TimerId::LINE_MONITOR);
 
-        // Activate interrupts for USART
+        // Activate interrupts for USART: commands are accepted before the startup report is sent
         usart.startInterrupt(InterruptPriority(2, 0));
-        usart.receiveIt(outputProcessor.usartBuffer, OnkyoRiOutputProcessor::USART_CMD_LENGHT);
+        usart.receiveIt(hostCommand.usartBuffer, HostCommand::USART_CMD_LENGHT);
+        const uint32_t readyTime = HAL_GetTick();
+
+        USART_REPORT("--------------------------------------------------------" << UsartLogger::ENDL);
+        USART_REPORT("MCU frequency: " << System::getMcuFreq()
+                     << (System::getClockSource() == System::ClockSource::HSE ? " (HSE)" : " (HSI)")
+                     << UsartLogger::ENDL);
+        USART_REPORT("RI ports: " << RI_PORTS_COUNT << UsartLogger::ENDL);
+        #ifdef RI_ANALOG_INPUT
+        USART_REPORT("RI0 input: comparator " << (frontEndStarted ? "started" : "failed") << UsartLogger::ENDL);
+        #endif
+        #ifdef RI_SAMPLED_INPUT
+        USART_REPORT("RI inputs: sampled " << (samplerStarted ? "started" : "failed") << UsartLogger::ENDL);
+        #endif
+        USART_REPORT("Line monitor: " << (monitorStarted ? "started" : "failed") << UsartLogger::ENDL);
+        CrashDump::report();
+        USART_REPORT("Learned frames: " << (framesLoaded ? "loaded" : "empty") << UsartLogger::ENDL);
+        USART_REPORT("Ready: " << readyTime << " ms" << UsartLogger::ENDL);
+        riLed.setLow();
+
+        // From now on, a hang of the main loop resets the MCU
+        watchdog.start(WATCHDOG_TIMEOUT);
         
         while (true)
         {
-            if (!eventQueue.empty())
-            {   
-                Event event = eventQueue.get();
-                switch(event)
+            watchdog.refresh();
+            dispatch(rxEvents, rxLatency, RX_EVENTS_PER_LOOP);
+            dispatch(txEvents, txLatency, TX_EVENTS_PER_LOOP);
+            processTx();
+            timers.process(HAL_GetTick());
+            processStalledCommand();
+            dispatch(hostEvents, hostLatency, HOST_EVENTS_PER_LOOP);
+            selfTest.processTick();
+            processLearn();
+            processCapture();
+            __NOP();
+        }
+    }
+    
+    template <typename Queue>
+    void dispatch (Queue & queue, EventLatency & latency, size_t maxEvents)
+    {
+        for (size_t i = 0; i < maxEvents && !queue.empty(); i++)
+        {
+            const Event event = queue.get();
+            const uint16_t l = uint16_t(rxTimer.getValue()) - event.time;
+            latency.events++;
+            latency.maxLatency = l > latency.maxLatency ? l : latency.maxLatency;
+            processEvent(event);
+        }
+    }
+
+    void processEvent (const Event & event)
+    {
+        CrashDump::putEvent(uint8_t(event.type), event.port);
+        switch(event.type)
+        {
+        case EventType::RI_CMD_START:
+            USART_INFO("RI%u: ", event.port);
+            blinkLed();
+            ports[event.port].inputProcessor.processMsgStart();
+            timers.cancel(rxTimeouts[event.port]);
+            rxTimeouts[event.port] = startTimer(RX_FRAME_TIMEOUT, TimerId::RX_TIMEOUT, event.port);
+            break;
+        case EventType::RI_CMD_LOW:
+        case EventType::RI_CMD_HIGH:
+            USART_TRACE("%u", int(event.type));
+            if (ports[event.port].inputProcessor.processMsgBit(event.type == EventType::RI_CMD_HIGH))
+            {
+                processRxFrame(ports[event.port], ports[event.port].inputProcessor.command);
+                timers.cancel(rxTimeouts[event.port]);
+            }
+            break;
+        case EventType::USART_INPUT:
+            processHostCommand(event.payload.command);
+            break;
+        case EventType::RI_TX_DONE:
+            processTxDone(ports[event.port]);
+            break;
+        case EventType::USART_ERROR:
+            // Reception is aborted by the HAL on errors: restart it. While a command is stalled, the
+            // reception is stopped on purpose and restarted once the stalled command is executed:
+            // restarting it here would lift the flow control and let the host overrun the TX queue
+            USART_WARN("\nUSART: error %x\n", event.payload.error);
+            hostCommand.reset();
+            if (!hostStalled)
+            {
+                usart.receiveIt(hostCommand.usartBuffer, HostCommand::USART_CMD_LENGHT);
+            }
+            break;
+        }
+    }
+
+    void processHostCommand (const HostCommand::Command & command)
+    {
+        usartCommands++;
+
+        // The sequence ID only applies to the command that follows it
+        if (command.state == HostCommand::State::VALID && command.opcode == HostCommand::OPCODE_SEQUENCE)
+        {
+            nextSequence = command.argument;
+            usart.receiveIt(hostCommand.usartBuffer, HostCommand::USART_CMD_LENGHT);
+            return;
+        }
+        const int32_t sequence = nextSequence;
+        nextSequence = OnkyoRiPort::NO_SEQUENCE;
+
+        #if USART_FLOW_CONTROL > 0
+        // The reception is not restarted until the TX queue has space: the USART holds RTS inactive
+        // after the next byte, so the host is throttled instead of the command being rejected
+        OnkyoRiPort * port = getTxTarget(command);
+        if (port != NULL && port->txQueue.full())
+        {
+            stalledCommand = command;
+            stalledSequence = sequence;
+            hostStalled = true;
+            usartStalls++;
+            return;
+        }
+        #endif
+        executeHostCommand(command, sequence);
+    }
+
+    void processStalledCommand ()
+    {
+        if (hostStalled && !getTxTarget(stalledCommand)->txQueue.full())
+        {
+            hostStalled = false;
+            executeHostCommand(stalledCommand, stalledSequence);
+        }
+    }
+
+    OnkyoRiPort * getTxTarget (const HostCommand::Command & command)
+    {
+        if (command.state != HostCommand::State::VALID)
+        {
+            return NULL;
+        }
+        if (command.isPortCommand() && command.getPort() < RI_PORTS_COUNT)
+        {
+            return &ports[command.getPort()];
+        }
+        if (command.opcode == HostCommand::OPCODE_REPLAY && size_t(command.argument >> 12) < RI_PORTS_COUNT)
+        {
+            return &ports[command.argument >> 12];
+        }
+        return NULL;
+    }
+
+    void executeHostCommand (const HostCommand::Command & command, int32_t sequence)
+    {
+        const uint32_t argument = command.argument;
+        AckStatus ack = AckStatus::DONE;
+
+        if (command.state == HostCommand::State::VALID && command.isPortCommand()
+            && command.getPort() < RI_PORTS_COUNT && !selfTest.isActive(ports[command.getPort()]))
+        {
+            OnkyoRiPort & port = ports[command.getPort()];
+            USART_INFO("\nUSART: %x -> RI%u\n", argument, port.id);
+            ack = queueTx(port, OnkyoRiPort::TxRequest { argument, sequence });
+        }
+        else if (command.state == HostCommand::State::VALID && command.opcode == HostCommand::OPCODE_SELF_TEST
+                 && (argument >> 12) < RI_PORTS_COUNT && !selfTest.isActive())
+        {
+            selfTest.start(ports[argument >> 12], argument & 0xFFF);
+        }
+        else if (command.state == HostCommand::State::VALID && command.opcode == HostCommand::OPCODE_GLITCH_FILTER
+                 && (argument >> 12) < RI_PORTS_COUNT)
+        {
+            OnkyoRiPort & port = ports[argument >> 12];
+            port.inputProcessor.setMinPulse(argument & 0xFFF);
+            USART_REPLY("\nRI%u: min pulse %u, glitches %u\n", port.id, port.inputProcessor.getMinPulse(),
+                        port.statistics.rxGlitches);
+        }
+        else if (command.state == HostCommand::State::VALID && command.opcode == HostCommand::OPCODE_IDLE_GAP
+                 && (argument >> 12) < RI_PORTS_COUNT)
+        {
+            OnkyoRiPort & port = ports[argument >> 12];
+            port.setIdleGap(argument & 0xFFF);
+            USART_REPLY("\nRI%u: idle gap %u ms, collisions %u, deferrals %u\n", port.id, port.getIdleGap(),
+                        port.statistics.txCollisions, port.statistics.txDeferrals);
+        }
+        else if (command.state == HostCommand::State::VALID && command.opcode == HostCommand::OPCODE_CAPTURE)
+        {
+            if (argument != 0)
+            {
+                startCapture(argument & ((1 << RI_PORTS_COUNT) - 1));
+            }
+            else
+            {
+                stopCapture();
+            }
+        }
+        else if (command.state == HostCommand::State::VALID && command.opcode == HostCommand::OPCODE_LEARN
+                 && (argument >> 12) < RI_PORTS_COUNT && !frameStore.isLearning()
+                 && frameStore.startLearn(argument >> 12, argument & 0xFF))
+        {
+            USART_REPLY("\nLEARN: waiting for a frame on RI%u\n", argument >> 12);
+        }
+        else if (command.state == HostCommand::State::VALID && command.opcode == HostCommand::OPCODE_REPLAY
+                 && (argument >> 12) < RI_PORTS_COUNT
+                 && frameStore.getSize(argument & 0xFF) > 0)
+        {
+            OnkyoRiPort & port = ports[argument >> 12];
+            USART_INFO("\nREPLAY: slot %u -> RI%u\n", argument & 0xFF, port.id);
+            ack = queueTx(port, OnkyoRiPort::TxRequest { OnkyoRiPort::REPLAY_FLAG | (argument & 0xFF),
+                                                         sequence });
+        }
+        else if (command.state == HostCommand::State::VALID && command.opcode == HostCommand::OPCODE_SAVE)
+        {
+            USART_REPORT(UsartLogger::ENDL << "LEARN: slots " << (frameStore.save() ? "saved" : "not saved")
+                         << UsartLogger::ENDL);
+        }
+        #ifdef RI_ANALOG_INPUT
+        else if (command.state == HostCommand::State::VALID && command.opcode == HostCommand::OPCODE_THRESHOLD)
+        {
+            frontEnd.setThreshold(argument & 0xFFF, (argument >> 12) * 32);
+            USART_REPLY("\nRI0: threshold %u, hysteresis %u, line %u...%u\n", frontEnd.getThreshold(),
+                        frontEnd.getHysteresis(), frontEnd.getLowLevel(), frontEnd.getHighLevel());
+        }
+        #endif
+        else if (command.state == HostCommand::State::VALID && command.opcode == HostCommand::OPCODE_STATISTICS)
+        {
+            reportStatistics(argument == 1);
+        }
+        else if (command.state == HostCommand::State::VALID && command.opcode == HostCommand::OPCODE_LOG_LEVEL
+                 && UsartLogger::setLevel(argument >> 8, argument & 0xFF))
+        {
+            USART_REPLY("\nLOG: module %x, level %u\n", argument >> 8, argument & 0xFF);
+        }
+        else
+        {
+            usartInvalidCommands++;
+            ack = AckStatus::REJECTED;
+            USART_WARN("\nUSART: invalid command\n");
+        }
+        acknowledge(sequence, ack);
+        usart.receiveIt(hostCommand.usartBuffer, HostCommand::USART_CMD_LENGHT);
+    }
+
+    AckStatus queueTx (OnkyoRiPort & port, const OnkyoRiPort::TxRequest & request)
+    {
+        // A full queue would overwrite the oldest request
+        if (port.txQueue.full())
+        {
+            return AckStatus::REJECTED;
+        }
+        port.txQueue.put(request);
+        return AckStatus::QUEUED;
+    }
+
+    void acknowledge (int32_t sequence, AckStatus status)
+    {
+        if (sequence == OnkyoRiPort::NO_SEQUENCE)
+        {
+            return;
+        }
+        static const char * const DIGITS = "0123456789abcdef";
+        static const char * const STATUS_NAMES[] = { " queued\n\r", " done\n\r", " rejected\n\r", " dropped\n\r" };
+
+        // Acknowledgements belong to the host protocol, not to the log: they are sent as text lines
+        // independent of the log tokenization and levels, and only held back by the binary capture
+        if (capture.isActive())
+        {
+            return;
+        }
+        char buffer[32] = "ACK 0x";
+        size_t n = ::strlen(buffer);
+        int shift = 28;
+        while (shift > 0 && (uint32_t(sequence) >> shift) == 0)
+        {
+            shift -= 4;
+        }
+        for (; shift >= 0; shift -= 4)
+        {
+            buffer[n++] = DIGITS[(uint32_t(sequence) >> shift) & 0xF];
+        }
+        ::strcpy(buffer + n, STATUS_NAMES[uint8_t(status)]);
+        usart.transmit(buffer);
+    }
+
+    void reportStatistics (bool reset)
+    {
+        USART_REPORT(UsartLogger::ENDL << "STAT: up=" << HAL_GetTick()
+                     << " usart=" << usartCommands << "," << usartInvalidCommands << "," << usartErrors
+                     << "," << usartStalls
+                     << " timers=" << timers.getActive() << "," << timers.getHighWater()
+                     << " lock=" << InterruptLock::getMaxCycles() / (System::getMcuFreq() / 1000000)
+                     << UsartLogger::ENDL);
+        reportEventStatistics("rx", rxEvents, rxLatency);
+        reportEventStatistics("tx", txEvents, txLatency);
+        reportEventStatistics("host", hostEvents, hostLatency);
+        #ifdef RI_ANALOG_INPUT
+        USART_REPORT("STAT: analog supply=" << monitor.getSupply() << " line=" << monitor.getLineAverage() << ","
+                     << monitor.getLineMin() << "," << monitor.getLineMax() << " idle="
+                     << (monitor.getIdleLevel() == LineMonitor::NO_LEVEL ? 0 : monitor.getIdleLevel())
+                     << " swing=" << monitor.getFrameSwing() << UsartLogger::ENDL);
+        #else
+        USART_REPORT("STAT: analog supply=" << monitor.getSupply() << UsartLogger::ENDL);
+        #endif
+        #ifdef RI_SAMPLED_INPUT
+        USART_REPORT("STAT: sampled blocks=" << sampler.getBlocks() << " edges=" << sampler.getVotedEdges()
+                     << " max=" << sampler.getMaxBlockEdges() << UsartLogger::ENDL);
+        #endif
+        USART_REPORT("STAT: ram data=" << System::getDataSize() << " bss=" << System::getBssSize()
+                     << " stack=" << System::getStackPeak() << "/" << System::getStackSize() << UsartLogger::ENDL);
+        for (size_t i = 0; i < RI_PORTS_COUNT; i++)
+        {
+            const OnkyoRiStatistics & st = ports[i].statistics;
+            USART_REPORT("STAT: RI" << int(i)
+                         << " rx=" << st.rxFrames << "," << st.rxIncomplete << "," << st.rxInvalidEdges
+                         << "," << st.rxGlitches
+                         << " tx=" << st.txFrames << "," << st.txCollisions << "," << st.txDropped
+                         << "," << st.txDeferrals << "," << st.txVerified << "," << st.txCorrupted
+                         << " q=" << ports[i].txQueue.getHighWater() << "," << ports[i].txQueue.getOverflows()
+                         << UsartLogger::ENDL);
+        }
+        if (reset)
+        {
+            // The counters are also written by the TX timer interrupt: mask all interrupts
+            InterruptLock lock(0);
+            InterruptLock::resetMaxCycles();
+            rxEvents.resetStatistics();
+            txEvents.resetStatistics();
+            hostEvents.resetStatistics();
+            rxLatency = txLatency = hostLatency = EventLatency { 0, 0 };
+            usartCommands = usartInvalidCommands = usartErrors = usartStalls = 0;
+            for (size_t i = 0; i < RI_PORTS_COUNT; i++)
+            {
+                ports[i].statistics.reset();
+                ports[i].txQueue.resetStatistics();
+            }
+            #ifdef RI_SAMPLED_INPUT
+            sampler.resetMaxBlockEdges();
+            #endif
+        }
+    }
+
+    template <typename Queue>
+    void reportEventStatistics (const char * name, const Queue & queue, const EventLatency & latency)
+    {
+        USART_REPORT("STAT: ev " << name << " n=" << latency.events << " q=" << queue.getHighWater() << ","
+                     << queue.getOverflows() << " lat=" << latency.maxLatency * 10 << UsartLogger::ENDL);
+    }
+
+    void startCapture (uint32_t portMask)
+    {
+        if (capture.isActive() || portMask == 0)
+        {
+            return;
+        }
+        USART_REPORT(UsartLogger::ENDL << "CAPTURE: started, ports " << UsartLogger::HEX << portMask
+                     << UsartLogger::DEC << UsartLogger::ENDL);
+        // From now on, the USART only carries the binary edge stream
+        usart.suspendInstance();
+        capture.start(portMask, rxTimer.getValue());
+        for (size_t i = 0; i < RI_PORTS_COUNT; i++)
+        {
+            ports[i].capture = capture.isPortActive(i) ? &capture : NULL;
+        }
+    }
+
+    void stopCapture ()
+    {
+        if (!capture.isActive())
+        {
+            return;
+        }
+        for (size_t i = 0; i < RI_PORTS_COUNT; i++)
+        {
+            ports[i].capture = NULL;
+        }
+        capture.stop();
+        // Flush the rest of the stream in blocking mode
+        while (usart.isTxBusy());
+        capture.releaseChunk();
+        const char * data = NULL;
+        while (size_t n = capture.getChunk(data))
+        {
+            watchdog.refresh();
+            usart.transmit(data, n, 0xFFFF);
+            capture.releaseChunk();
+        }
+        usart.resumeInstance();
+        USART_REPORT(UsartLogger::ENDL << "CAPTURE: stopped, edges " << capture.getEdges()
+                     << ", dropped " << capture.getDroppedEdges() << ", bytes " << capture.getBytesSent()
+                     << ", buffer high water " << capture.getHighWater() << "/" << EdgeCapture::BUFFER_SIZE
+                     << UsartLogger::ENDL);
+    }
+
+    void processCapture ()
+    {
+        if (capture.isActive() && !usart.isTxBusy())
+        {
+            capture.releaseChunk();
+            const char * data = NULL;
+            size_t n = capture.getChunk(data);
+            if (n > 0)
+            {
+                usart.transmitIt(data, n);
+            }
+        }
+    }
+
+    void processLearn ()
+    {
+        if (frameStore.isLearning() && frameStore.getDurationsCount() > 0
+            && ports[frameStore.getLearnPort()].isBusIdle())
+        {
+            const size_t durations = frameStore.getDurationsCount();
+            const int size = frameStore.finishLearn();
+            if (size > 0)
+            {
+                USART_INFO("LEARN: slot %u, pulses %u, bytes %u\n", frameStore.getLearnSlot(), durations, size);
+            }
+            else
+            {
+                if (size == OnkyoRiFrameStore::TOO_LONG)
+                {
+                    USART_WARN("LEARN: frame too long\n");
+                }
+                else
                 {
-                case Event::RI_CMD_START:
-                    USART_DEBUG("RI: ");
-                    riLed.setHigh();
-                    inputProcessor.processMsgStart();
-                    break;
-                case Event::RI_CMD_LOW:
-                case Event::RI_CMD_HIGH:
-                    USART_DEBUG("" << int(event))
-                    if (inputProcessor.processMsgBit(event == Event::RI_CMD_LOW ? false : true))
-                    {
-                        USART_DEBUG(" = " << UsartLogger::HEX << inputProcessor.command 
-                                    << UsartLogger::DEC << UsartLogger::ENDL);
-                        riLed.setLow();
-                    }
-                    break;
-                case Event::USART_INPUT:
-                    if (outputProcessor.processUsartIrq())
-                    {
-                        riLed.setHigh();
-                        USART_DEBUG(UsartLogger::ENDL 
-                                    << "USART: " << UsartLogger::HEX << outputProcessor.command 
-                                    << UsartLogger::DEC << UsartLogger::ENDL);
-                        HAL_NVIC_DisableIRQ(RI_INPUT_IRQN);
-                        outputProcessor.sendBlocking();
-                        HAL_NVIC_EnableIRQ(RI_INPUT_IRQN);
-                        riLed.setLow();
-                        usart.receiveIt(outputProcessor.usartBuffer, OnkyoRiOutputProcessor::USART_CMD_LENGHT);
-                    }
-                    break;
+                    USART_WARN("LEARN: too many different pulses\n");
                 }
             }
-            __NOP();
+        }
+    }
+
+    void processTx ()
+    {
+        const uint32_t now = HAL_GetTick();
+        for (size_t i = 0; i < RI_PORTS_COUNT; i++)
+        {
+            if (selfTest.isActive(ports[i]))
+            {
+                continue;
+            }
+            // The frame done event may come before the input has passed the end of the frame
+            processTxDone(ports[i]);
+            if (ports[i].processTx(now))
+            {
+                blinkLed();
+            }
+        }
+    }
+
+    void processRxFrame (OnkyoRiPort & port, uint32_t code)
+    {
+        // The receiver runs during the own transmission: its echo is tagged, other frames are delivered
+        switch (port.processRxFrame(code))
+        {
+        case OnkyoRiPort::RxResult::FRAME:
+            USART_INFO(" = %x\n", code);
+            break;
+        case OnkyoRiPort::RxResult::ECHO:
+            USART_INFO(" = %x echo\n", code);
+            break;
+        case OnkyoRiPort::RxResult::CORRUPTED:
+            USART_WARN(" = %x, corrupted echo of %x\n", code,
+                       port.outputProcessor.getCommand() & OnkyoRiPort::RI_CODE_MASK);
+            break;
+        }
+        selfTest.processFrame(port, code);
+    }
+
+    void processTxDone (OnkyoRiPort & port)
+    {
+        if (!selfTest.isActive(port))
+        {
+            switch (port.processTxDone(HAL_GetTick(), getInputTime()))
+            {
+            case OnkyoRiPort::TxResult::PENDING:
+                break;
+            case OnkyoRiPort::TxResult::DONE:
+                acknowledge(port.getTxSequence(), AckStatus::DONE);
+                break;
+            case OnkyoRiPort::TxResult::COLLISION:
+                USART_WARN("RI%u: collision, retry\n", port.id);
+                break;
+            case OnkyoRiPort::TxResult::DROPPED:
+                USART_ERROR("RI%u: collision, dropped %x\n", port.id, port.outputProcessor.getCommand());
+                acknowledge(port.getTxSequence(), AckStatus::DROPPED);
+                break;
+            }
+        }
+    }
+
+    /**
+     * @brief RX timer value up to which the input edges have been passed to the ports.
+     */
+    uint32_t getInputTime () const
+    {
+        #ifdef RI_SAMPLED_INPUT
+        return sampler.getInputTime();
+        #else
+        return rxTimer.getValue();
+        #endif
+    }
+
+    TimerWheel::Handle startTimer (uint32_t delay, TimerId id, uint8_t port = 0)
+    {
+        return timers.start(HAL_GetTick(), delay, onTimer, this, uint32_t(id) | (uint32_t(port) << 8));
+    }
+
+    static void onTimer (void * context, uint32_t arg)
+    {
+        ((MyApplication *) context)->processTimer(TimerId(arg & 0xFF), arg >> 8);
+    }
+
+    void processTimer (TimerId id, uint8_t port)
+    {
+        switch (id)
+        {
+        case TimerId::LED_OFF:
+            riLed.setLow();
+            break;
+        case TimerId::RX_TIMEOUT:
+            if (ports[port].inputProcessor.processMsgTimeout())
+            {
+                USART_WARN("\nRI%u: incomplete frame\n", port);
+            }
+            break;
+        case TimerId::LINE_MONITOR:
+            processLineMonitor();
+            startTimer(LINE_MONITOR_WINDOW, TimerId::LINE_MONITOR);
+            break;
+        }
+    }
+
+    void processLineMonitor ()
+    {
+        const uint32_t changes = monitor.processWindow();
+        if (changes & LineMonitor::SUPPLY)
+        {
+            if (monitor.isSupplyLow())
+            {
+                USART_WARN("\nSUPPLY: low, %u mV\n", monitor.getSupply());
+            }
+            else
+            {
+                USART_INFO("\nSUPPLY: restored, %u mV\n", monitor.getSupply());
+            }
+        }
+        #ifdef RI_ANALOG_INPUT
+        // The line level is only measured when PA7 is the RI input
+        frontEnd.processLevels(monitor.getRawMin(), monitor.getRawMax());
+        if (changes & LineMonitor::IDLE_LEVEL)
+        {
+            USART_WARN("\nRI0: idle level %u -> %u mV, device power changed\n", monitor.getPrevIdleLevel(),
+                       monitor.getIdleLevel());
+        }
+        if (changes & LineMonitor::FRAME_SWING)
+        {
+            if (monitor.isSwingWeak())
+            {
+                USART_WARN("\nRI0: weak frames, swing %u mV\n", monitor.getFrameSwing());
+            }
+            else
+            {
+                USART_INFO("\nRI0: frame swing restored, %u mV\n", monitor.getFrameSwing());
+            }
+        }
+        #endif
+    }
+
+    void blinkLed ()
+    {
+        riLed.setHigh();
+        timers.cancel(ledTimer);
+        ledTimer = startTimer(LED_BLINK_TIME, TimerId::LED_OFF);
+    }
+
+    void processRiInputIrq (size_t port)
+    {
+        int val = ports[port].processExtiIrq();
+        if (val >= 0)
+        {
+            rxEvents.put(Event { EventType(val), uint8_t(port), uint16_t(rxTimer.getValue()), EventPayload() });
         }
     }
     
-    void processRiInputIrq ()
+    #ifdef RI_ANALOG_INPUT
+    void processAnalogInputIrq ()
     {
-        if (__HAL_GPIO_EXTI_GET_FLAG(RI_INPUT_PIN))
+        if (frontEnd.processCaptureIrq())
         {
-            int val = inputProcessor.processPinIrq(riInput.getBit());
+            int val = ports[0].processEdge(frontEnd.getLevel(), frontEnd.getEdgeTime());
             if (val >= 0)
             {
-                eventQueue.put(Event(val));
+                rxEvents.put(Event { EventType(val), 0, uint16_t(rxTimer.getValue()), EventPayload() });
             }
         }
-        HAL_GPIO_EXTI_IRQHandler(RI_INPUT_PIN);
     }
-    
+    #endif
+
+    #ifdef RI_SAMPLED_INPUT
+    void processSampledInputIrq ()
+    {
+        sampler.processDmaInterrupt();
+    }
+
+    static void onSampledEdge (void * context, uint8_t channel, bool level, uint32_t time)
+    {
+        MyApplication * app = (MyApplication *) context;
+        int val = app->ports[channel].processEdge(level, time);
+        if (val >= 0)
+        {
+            app->rxEvents.put(Event { EventType(val), channel, uint16_t(app->rxTimer.getValue()), EventPayload() });
+        }
+    }
+    #endif
+
+    void processMonitorIrq ()
+    {
+        monitor.processDmaInterrupt();
+    }
+
+    void processMonitorSamples (bool secondHalf)
+    {
+        monitor.processBlock(secondHalf);
+    }
+
+    void processTxTimerIrq ()
+    {
+        for (size_t i = 0; i < RI_PORTS_COUNT; i++)
+        {
+            if (txTimer.processCompareIt(ports[i].config.txChannel) && ports[i].processTxTimerIrq())
+            {
+                txEvents.put(Event { EventType::RI_TX_DONE, uint8_t(i), uint16_t(rxTimer.getValue()),
+                                     EventPayload() });
+            }
+        }
+    }
+
+    void processUsartError (uint32_t error)
+    {
+        usartErrors++;
+        hostEvents.put(Event { EventType::USART_ERROR, 0, uint16_t(rxTimer.getValue()), error });
+    }
+
     void processUsartIrq ()
     {
         usart.processInterrupt();
-        eventQueue.put(Event::USART_INPUT);
+        const HostCommand::Command command = hostCommand.processUsartIrq();
+        if (command.state != HostCommand::State::INCOMPLETE)
+        {
+            hostEvents.put(Event { EventType::USART_INPUT, 0, uint16_t(rxTimer.getValue()), command });
+        }
     }
 };
 
@@ -147,20 +939,16 @@ MyApplication * appPtr = NULL;
 
 int main (void)
 {
+    // Shall be done before any deeper call
+    System::paintStack();
+
     // Note: check the Value of the External oscillator mounted in PCB
     // and set this value in the file stm32f3xx_hal_conf.h
     
     HAL_Init();
-    
-    IOPort defaultPortA(IOPort::PortName::A, GPIO_MODE_INPUT, GPIO_PULLDOWN, GPIO_SPEED_LOW);
-    IOPort defaultPortB(IOPort::PortName::B, GPIO_MODE_INPUT, GPIO_PULLDOWN, GPIO_SPEED_LOW);
-    IOPort defaultPortC(IOPort::PortName::C, GPIO_MODE_INPUT, GPIO_PULLDOWN, GPIO_SPEED_LOW);
-    
-    do
-    {
-        System::setClock(RCC_HSE_PREDIV_DIV2, RCC_PLL_MUL9, FLASH_LATENCY_2, System::RtcType::RTC_INT);
-    }
-    while (System::getMcuFreq() != 72000000L);
+
+    // 72 MHz from HSE (16 MHz / 2 * 9) or 64 MHz from HSI (8 MHz / 2 * 16) if there is no crystal
+    System::setClock(RCC_HSE_PREDIV_DIV2, RCC_PLL_MUL9, RCC_PLL_MUL16, FLASH_LATENCY_2, System::RtcType::RTC_NONE);
     
     MyApplication app;
     appPtr = &app;
@@ -175,10 +963,64 @@ extern "C" void SysTick_Handler (void)
 
 extern "C" void EXTI1_IRQHandler (void)
 {
-    appPtr->processRiInputIrq();
+    appPtr->processRiInputIrq(0);
+}
+
+extern "C" void EXTI0_IRQHandler (void)
+{
+    appPtr->processRiInputIrq(1);
+}
+
+extern "C" void EXTI4_IRQHandler (void)
+{
+    appPtr->processRiInputIrq(2);
+}
+
+extern "C" void EXTI9_5_IRQHandler (void)
+{
+    appPtr->processRiInputIrq(3);
+}
+
+#ifdef RI_ANALOG_INPUT
+extern "C" void TIM2_IRQHandler (void)
+{
+    appPtr->processAnalogInputIrq();
+}
+#endif
+
+extern "C" void TIM3_IRQHandler (void)
+{
+    appPtr->processTxTimerIrq();
+}
+
+#ifdef RI_SAMPLED_INPUT
+extern "C" void DMA1_Channel3_IRQHandler (void)
+{
+    appPtr->processSampledInputIrq();
+}
+#endif
+
+extern "C" void DMA1_Channel2_IRQHandler (void)
+{
+    appPtr->processMonitorIrq();
+}
+
+extern "C" void HAL_ADC_ConvHalfCpltCallback (ADC_HandleTypeDef *)
+{
+    appPtr->processMonitorSamples(false);
+}
+
+extern "C" void HAL_ADC_ConvCpltCallback (ADC_HandleTypeDef *)
+{
+    appPtr->processMonitorSamples(true);
 }
 
 extern "C" void USART1_IRQHandler (void)
 {
     appPtr->processUsartIrq();
 }
+
+extern "C" void HAL_UART_ErrorCallback (UART_HandleTypeDef * huart)
+{
+    appPtr->processUsartError(huart->ErrorCode);
+}
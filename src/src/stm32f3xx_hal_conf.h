@@ -50,6 +50,9 @@
 /**
   * @brief This is the list of modules to be used in the HAL driver 
   */
+/* The default profile only enables the modules used by the firmware: it reduces the build time
+   and the flash footprint without section GC. Define HAL_FULL_PROFILE to enable all modules. */
+#ifdef HAL_FULL_PROFILE
 #define HAL_MODULE_ENABLED
 #define HAL_ADC_MODULE_ENABLED
 #define HAL_CAN_MODULE_ENABLED
@@ -84,6 +87,23 @@
 #define HAL_UART_MODULE_ENABLED
 #define HAL_USART_MODULE_ENABLED
 #define HAL_WWDG_MODULE_ENABLED
+#else
+#define HAL_MODULE_ENABLED
+#define HAL_ADC_MODULE_ENABLED
+#define HAL_CORTEX_MODULE_ENABLED
+#define HAL_DMA_MODULE_ENABLED
+#define HAL_FLASH_MODULE_ENABLED
+#define HAL_GPIO_MODULE_ENABLED
+#define HAL_IWDG_MODULE_ENABLED
+#define HAL_RCC_MODULE_ENABLED
+#define HAL_SPI_MODULE_ENABLED
+#define HAL_TIM_MODULE_ENABLED
+#define HAL_UART_MODULE_ENABLED
+#ifdef RI_ANALOG_INPUT
+#define HAL_COMP_MODULE_ENABLED
+#define HAL_DAC_MODULE_ENABLED
+#endif
+#endif /* HAL_FULL_PROFILE */
 
 /* ########################## HSE/HSI Values adaptation ##################### */
 /**
@@ -100,7 +120,7 @@
   *        Timeout value 
   */
 #if !defined  (HSE_STARTUP_TIMEOUT)
-  #define HSE_STARTUP_TIMEOUT    ((uint32_t)500)   /*!< Time out for HSE start up, in ms */
+  #define HSE_STARTUP_TIMEOUT    ((uint32_t)50)    /*!< Time out for HSE start up, in ms */
 #endif /* HSE_STARTUP_TIMEOUT */
 
 /**
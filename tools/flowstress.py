@@ -0,0 +1,116 @@
+#!/usr/bin/env python3
+#
+# onkyoUsbRi: Onkyo RI control
+#
+# Copyright (C) 2021. Mikhail Kulesh
+#
+# This program is free software: you can redistribute it and/or modify it under the terms of the GNU
+# General Public License as published by the Free Software Foundation, either version 3 of the License,
+# or (at your option) any later version.
+#
+# This program is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without
+# even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+# GNU General Public License for more details. You should have received a copy of the GNU General
+# Public License along with this program.
+#
+
+"""
+Stress test of the host link flow control (firmware built with USART_FLOW_CONTROL 1 or 2).
+
+Sends the given number of RI commands, each with a sequence ID, back-to-back at the full line
+rate and checks that every command is acknowledged as queued and then done. Without flow control,
+the TX queue of the port overflows and commands are rejected or lost in the USART.
+
+The log shall not be tokenized and the log level of the USART and RI modules shall not be "off".
+
+Usage:
+    flowstress.py /dev/ttyUSB0 [count] [command]
+
+    count: number of commands (default 100), command: RI command (default 0x0020)
+"""
+
+import os
+import re
+import sys
+import termios
+import threading
+import time
+import tty
+
+ACK = re.compile(rb"ACK 0x([0-9a-fA-F]+) (queued|done|rejected|dropped)")
+INVALID = re.compile(rb"invalid command")
+FINAL = ("done", "dropped", "rejected")
+
+
+def open_port(path):
+    fd = os.open(path, os.O_RDWR | os.O_NOCTTY)
+    tty.setraw(fd)
+    attr = termios.tcgetattr(fd)
+    attr[2] |= termios.CRTSCTS | termios.CLOCAL
+    attr[4] = attr[5] = termios.B115200
+    termios.tcsetattr(fd, termios.TCSANOW, attr)
+    termios.tcflush(fd, termios.TCIOFLUSH)
+    return fd
+
+
+def main(argv):
+    if len(argv) < 2:
+        sys.stderr.write(__doc__)
+        return 1
+    count = int(argv[2]) if len(argv) > 2 else 100
+    command = argv[3] if len(argv) > 3 else "0x0020"
+    if len(command) != 6 or count < 1 or count > 0x10000:
+        sys.stderr.write(__doc__)
+        return 1
+    fd = open_port(argv[1])
+
+    states = {}
+    invalid = [0]
+    stop = threading.Event()
+
+    def reader():
+        line = b""
+        while not stop.is_set():
+            line += os.read(fd, 256)
+            *lines, line = line.split(b"\n")
+            for l in lines:
+                m = ACK.search(l)
+                if m:
+                    states[int(m.group(1), 16)] = m.group(2).decode()
+                elif INVALID.search(l):
+                    invalid[0] += 1
+
+    thread = threading.Thread(target=reader, daemon=True)
+    thread.start()
+
+    # The whole stream is written at once: only the flow control can pace it
+    start = time.time()
+    data = "".join("Nx%04X%s" % (seq, command) for seq in range(count)).encode()
+    written = 0
+    while written < len(data):
+        written += os.write(fd, data[written:])
+    sent = time.time() - start
+
+    # Each RI frame takes up to 60 ms including the idle gap
+    deadline = time.time() + 5 + count * 0.1
+    while time.time() < deadline and sum(s in FINAL for s in states.values()) < count:
+        time.sleep(0.1)
+    stop.set()
+    elapsed = time.time() - start
+
+    result = {s: 0 for s in FINAL}
+    for s in states.values():
+        if s in result:
+            result[s] += 1
+    missing = count - sum(result.values())
+    print("commands %d, written in %.2f s, completed in %.2f s (%.1f frames/s)"
+          % (count, sent, elapsed, result["done"] / elapsed))
+    print("done %d, dropped %d, rejected %d, missing %d, invalid %d"
+          % (result["done"], result["dropped"], result["rejected"], missing, invalid[0]))
+    ok = result["done"] == count and invalid[0] == 0
+    print("PASSED" if ok else "FAILED")
+    return 0 if ok else 2
+
+
+if __name__ == "__main__":
+    sys.exit(main(sys.argv))
@@ -0,0 +1,125 @@
+#!/usr/bin/env python3
+#
+# onkyoUsbRi: Onkyo RI control
+#
+# Copyright (C) 2021. Mikhail Kulesh
+#
+# This program is free software: you can redistribute it and/or modify it under the terms of the GNU
+# General Public License as published by the Free Software Foundation, either version 3 of the License,
+# or (at your option) any later version.
+#
+# This program is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without
+# even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+# GNU General Public License for more details. You should have received a copy of the GNU General
+# Public License along with this program.
+#
+
+"""
+Decoder of the tokenized USART log (firmware built with USART_LOG_TOKENIZED).
+
+The format strings are taken from the .logstr section of the firmware ELF file: the ID of a
+record is the offset of its format string in this section. Bytes outside of records (text
+logging) are passed through unchanged.
+
+Usage:
+    stty -F /dev/ttyUSB0 115200 raw
+    logdecode.py firmware.elf /dev/ttyUSB0 [--time]
+    logdecode.py firmware.elf --dict
+"""
+
+import re
+import struct
+import sys
+
+RECORD_START = 0x1E
+
+
+def read_dictionary(elf_path):
+    with open(elf_path, "rb") as f:
+        elf = f.read()
+    if elf[:4] != b"\x7fELF" or elf[4] != 1:
+        raise ValueError("not a 32-bit ELF file: " + elf_path)
+    shoff, = struct.unpack_from("<I", elf, 0x20)
+    shentsize, shnum, shstrndx = struct.unpack_from("<HHH", elf, 0x2E)
+
+    def section(i):
+        name, _, _, _, offset, size = struct.unpack_from("<IIIIII", elf, shoff + i * shentsize)
+        return name, offset, size
+
+    _, names_offset, _ = section(shstrndx)
+    for i in range(shnum):
+        name, offset, size = section(i)
+        end = elf.index(b"\0", names_offset + name)
+        if elf[names_offset + name:end] == b".logstr":
+            return elf[offset:offset + size]
+    raise ValueError("no .logstr section in " + elf_path)
+
+
+def format_string(dictionary, fid):
+    end = dictionary.find(b"\0", fid)
+    return dictionary[fid:end].decode("ascii", "replace")
+
+
+def render(fmt, args):
+    args = list(args)
+
+    def arg(m):
+        spec = m.group(1)
+        if spec == "%":
+            return "%"
+        v = args.pop(0) if args else 0
+        if spec == "d":
+            return str(v - (1 << 32) if v & 0x80000000 else v)
+        if spec == "x":
+            return hex(v)
+        return str(v)
+
+    return re.sub(r"%([dux%])", arg, fmt).replace("\n", "\n\r")
+
+
+def read_leb128(stream):
+    value = shift = 0
+    while True:
+        b = stream.read(1)
+        if not b:
+            raise EOFError
+        value |= (b[0] & 0x7F) << shift
+        shift += 7
+        if not b[0] & 0x80:
+            return value
+
+
+def decode(dictionary, stream, out, with_time):
+    while True:
+        b = stream.read(1)
+        if not b:
+            return
+        if b[0] != RECORD_START:
+            out.write(b.decode("ascii", "replace"))
+            continue
+        try:
+            fid, stamp, argc = (read_leb128(stream) for _ in range(3))
+            args = [read_leb128(stream) for _ in range(argc)]
+        except EOFError:
+            return
+        text = render(format_string(dictionary, fid), args)
+        out.write(("[%d.%03d] " % divmod(stamp, 1000) if with_time else "") + text)
+        out.flush()
+
+
+def main(argv):
+    if len(argv) < 3:
+        sys.stderr.write(__doc__)
+        return 1
+    dictionary = read_dictionary(argv[1])
+    if argv[2] == "--dict":
+        for m in re.finditer(rb"[^\0]+", dictionary):
+            print("%5d: %r" % (m.start(), m.group().decode("ascii", "replace")))
+        return 0
+    stream = sys.stdin.buffer if argv[2] == "-" else open(argv[2], "rb", buffering=0)
+    decode(dictionary, stream, sys.stdout, "--time" in argv[3:])
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main(sys.argv))
@@ -0,0 +1,87 @@
+#!/usr/bin/env python3
+#
+# onkyoUsbRi: Onkyo RI control
+#
+# Copyright (C) 2021. Mikhail Kulesh
+#
+# This program is free software: you can redistribute it and/or modify it under the terms of the GNU
+# General Public License as published by the Free Software Foundation, either version 3 of the License,
+# or (at your option) any later version.
+#
+# This program is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without
+# even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+# GNU General Public License for more details. You should have received a copy of the GNU General
+# Public License along with this program.
+#
+
+"""
+Per-module flash and RAM usage from the GNU ld map file of the firmware.
+
+Usage:
+    memusage.py onkyoUsbRi.map
+
+The map file is written by the linker option -Wl,-Map=onkyoUsbRi.map. For each object file
+(or library), the sizes of its input sections are summed per output section: .text, .rodata
+and the other ROM sections as flash, .data as flash and RAM, .bss and .noinit as RAM.
+"""
+
+import collections
+import os
+import re
+import sys
+
+FLASH = (".isr_vector", ".text", ".rodata", ".ARM.extab", ".ARM", ".preinit_array", ".init_array",
+         ".fini_array")
+COLUMNS = FLASH[:3] + (".data", ".bss", ".noinit")
+
+INPUT = re.compile(r"^ (\S+)?\s+0x([0-9a-f]+)\s+0x([0-9a-f]+)\s+(\S+)$")
+
+
+def module_name(path):
+    # "libc.a(lib_a-memset.o)" -> "libc.a"
+    return os.path.basename(path.split("(")[0])
+
+
+def parse(map_path):
+    usage = collections.defaultdict(collections.Counter)
+    output = None
+    pending = False
+    with open(map_path) as f:
+        for line in f:
+            line = line.rstrip("\n")
+            if line.startswith("."):
+                output = line.split()[0]
+                continue
+            if output is None:
+                continue
+            m = INPUT.match(line)
+            if m and (m.group(1) or pending):
+                usage[module_name(m.group(4))][output] += int(m.group(3), 16)
+            # Long input section names are followed by the address and the size on the next line
+            pending = bool(re.match(r"^ \.\S+$", line))
+    return usage
+
+
+def main(argv):
+    if len(argv) < 2:
+        sys.stderr.write(__doc__)
+        return 1
+    usage = parse(argv[1])
+    print("%-24s" % "module" + "".join("%10s" % c for c in COLUMNS) + "%10s%10s" % ("flash", "ram"))
+    total = collections.Counter()
+    for module in sorted(usage, key=lambda m: -sum(usage[m].values())):
+        u = usage[module]
+        flash = sum(u[s] for s in FLASH) + u[".data"]
+        ram = u[".data"] + u[".bss"] + u[".noinit"]
+        if flash + ram == 0:
+            continue
+        total.update(u)
+        print("%-24s" % module + "".join("%10d" % u[c] for c in COLUMNS) + "%10d%10d" % (flash, ram))
+    flash = sum(total[s] for s in FLASH) + total[".data"]
+    ram = total[".data"] + total[".bss"] + total[".noinit"]
+    print("%-24s" % "total" + "".join("%10d" % total[c] for c in COLUMNS) + "%10d%10d" % (flash, ram))
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main(sys.argv))